@@ -22,9 +22,16 @@ public:
     void setSize(double s) { size = s; }
 
     double hit(const ray &beamlet) override;
+    double apertureRadius() const override { return size; } // hit() accepts the whole mount
     void interact_ray(ray &beamlet) override;
+    void hit_bundle(const RayBundle &rays, double *t) override;
+    void interact_bundle(RayBundle &rays, const std::vector<int> &indices) override;
     void interact_wavefront(WaveFront &A) override;
+    bool interact_slab(FieldSlab &slab) override;
+    bool interact_beam(GaussianBeam &beam) override;
+    double added_angle(double half_width, double wavelength) const override { return wavelength * 8.0 / radius; } // Keeps ~16 pixels across the hole
     void reset() override {};
+    std::shared_ptr<OpticalElement> clone() const override { return std::make_shared<Iris>(*this); }
 };
 
 class Slit : public OpticalElement
@@ -53,9 +60,15 @@ public:
     void setNumSlits(int n) { num_slits = n; }
 
     double hit(const ray &beamlet) override;
+    double apertureRadius() const override { return size; } // hit() accepts the whole mount
     void interact_ray(ray &beamlet) override;
+    void hit_bundle(const RayBundle &rays, double *t) override;
+    void interact_bundle(RayBundle &rays, const std::vector<int> &indices) override;
     void interact_wavefront(WaveFront &A) override;
+    bool interact_slab(FieldSlab &slab) override;
+    double added_angle(double half_width, double wavelength) const override { return wavelength * 4.0 / width; } // Keeps ~8 pixels across each slit
     void reset() override {};
+    std::shared_ptr<OpticalElement> clone() const override { return std::make_shared<Slit>(*this); }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,76 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "fftw3.h"
+
+struct BufferPoolStats
+{
+    size_t bytesInUse = 0;     // Bytes currently handed out
+    size_t peakBytesInUse = 0; // High-water mark of bytesInUse
+    size_t bytesIdle = 0;      // Bytes held in the free lists
+    size_t heapAllocations = 0; // Blocks obtained from fftw_malloc
+    size_t reuses = 0;          // Requests served from the free lists
+};
+
+// Process-wide pool of aligned complex buffers for the FFT work of the simulation. Blocks are
+// grouped in size classes and returned to their class's free list on release, so the FFT scratch
+// (padded grids, kernels, spectra, chirp-z work) of repeated runs on the same grids stops touching
+// the heap after the first one. The Ex/Ey grids are not pooled: they are FieldGrid rows, allocated
+// when a wavefront is initialized or moves to a new grid. The free lists hold at most idleLimit
+// bytes; a block released beyond that goes straight back to the heap
+class BufferPool
+{
+private:
+    std::mutex lock;
+    std::map<size_t, std::vector<fftw_complex *>> freeLists; // Size class (elements) -> idle blocks
+    BufferPoolStats stats;
+    size_t idleLimit = size_t(1) << 30;
+
+    BufferPool() = default;
+
+public:
+    ~BufferPool();
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    static BufferPool &instance();
+    static size_t sizeClass(size_t count); // Rounds a request up to its class (whole 8 KiB pages)
+
+    fftw_complex *acquire(size_t count);            // Block of at least count elements, contents undefined
+    void release(fftw_complex *block, size_t count); // Returns a block obtained with the same count
+    void trim();                                     // Frees every idle block
+    void setIdleLimit(size_t bytes);                 // Caps the free lists, trimming them if they hold more
+    BufferPoolStats getStats();
+};
+
+// Owning handle to a pooled buffer of complex values, released back to the pool on destruction
+class PooledBuffer
+{
+private:
+    fftw_complex *block = nullptr;
+    size_t count = 0;
+
+public:
+    PooledBuffer() = default;
+    explicit PooledBuffer(size_t count);
+    ~PooledBuffer();
+
+    PooledBuffer(const PooledBuffer &) = delete;
+    PooledBuffer &operator=(const PooledBuffer &) = delete;
+    PooledBuffer(PooledBuffer &&other) noexcept;
+    PooledBuffer &operator=(PooledBuffer &&other) noexcept;
+
+    size_t size() const { return count; }
+    fftw_complex *fftw() const { return block; } // For FFTW plans
+    std::complex<double> *data() const { return reinterpret_cast<std::complex<double> *>(block); }
+    std::complex<double> &operator[](size_t i) const { return data()[i]; }
+};
+
+#endif
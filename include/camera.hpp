@@ -8,24 +8,60 @@
 class Camera : public OpticalElement
 {
 private:
-    WaveFront sensedWavefront;
     double size;
+    int resolution;              // Pixels across the region of interest
+    double roiSize;              // Width of the region of interest
+    double roiX, roiY;           // Centre of the region of interest relative to the sensor centre
+    WaveFront sensedWavefront;   // Declared after the sizes it is built from, in initialization order
+    bool zoomPropagation = true; // Evaluate incoming fields directly on the sensor grid
+    std::vector<double> exposureX, exposureY; // Intensities of mutually incoherent fields, summed per pixel (empty until the first exposure)
+    std::vector<std::complex<double>> phaseX, phaseY; // Unit phasors of the first exposed field (the coherent sources'), which develop() keeps
+    std::vector<double> spotX, spotY;         // Where traced rays landed, along v and u from the sensor centre
+
+    void rebuildSensor(); // Recreates the sensed wavefront for the current region of interest
 
 public:
-    Camera(const vec3 &position, const vec3 &orientation, const std::string name, double size = 0.02); // Constructor
-    virtual ~Camera() = default;                                                                       // Destructor
+    Camera(const vec3 &position, const vec3 &orientation, const std::string name, double size = 0.02, int resolution = 1024); // Constructor
+    virtual ~Camera() = default;                                                                                            // Destructor
 
     double getSize() { return size; }
+    int getResolution() const { return resolution; }
+    double getROISize() const { return roiSize; }
+    double getROIX() const { return roiX; }
+    double getROIY() const { return roiY; }
+    bool getZoomPropagation() const { return zoomPropagation; }
     WaveFront &getSensedWaveFront();
+    const std::vector<double> &getSpotX() const { return spotX; }
+    const std::vector<double> &getSpotY() const { return spotY; }
+    void clearSpots();
 
     void setPosition(vec3 pos) override;
     void setOrientation(vec3 o) override;
     void setSize(double s);
+    void setResolution(int pixels);
+    void setROI(double width, double x = 0.0, double y = 0.0);
+    void setZoomPropagation(bool enabled) { zoomPropagation = enabled; }
 
     double hit(const ray &beamlet) override;
+    double apertureRadius() const override { return size / std::sqrt(2.0); } // Corners of the square sensor
     void interact_ray(ray &beamlet) override;
+    void hit_bundle(const RayBundle &rays, double *t) override;
+    void interact_bundle(RayBundle &rays, const std::vector<int> &indices) override;
     void interact_wavefront(WaveFront &A) override;
+    void receive_wavefront(WaveFront &A, double distance) override;
+    bool interact_beam(GaussianBeam &beam) override;
     void reset() override;
+
+    // Fields held in pieces (slabs of ranks, blocks of mapped files): rows [i0, i1] and columns
+    // [j0, j1] of the field's whole grid that the region of interest interpolates from, false if
+    // none of them is on the grid; and adding one piece, resampled straight onto the sensor (the
+    // pieces of a field add up to the whole)
+    bool window(const FieldSlab &field, int &i0, int &i1, int &j0, int &j1);
+    void receiveSlab(const FieldSlab &rows) { sensedWavefront += rows; }
+
+    void expose(double weight); // Adds weight times the intensity of the sensed field to the exposure and clears the field
+    void develop();             // Replaces the sensed field by the square root of the exposure, with the phase of the first exposed field (zero where it had none)
+    std::shared_ptr<OpticalElement> clone() const override { return std::make_shared<Camera>(*this); }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,72 @@
+#ifndef DISTRIBUTED_WAVEFRONT_HPP
+#define DISTRIBUTED_WAVEFRONT_HPP
+
+#pragma once
+
+// Only built with the MPI backend (cmake -DOSL_WITH_MPI=ON), which needs MPI and fftw3_mpi
+#ifdef OSL_MPI
+
+#include <mpi.h>
+#include <string>
+#include "fftw3-mpi.h"
+#include "buffer_pool.hpp"
+#include "camera.hpp"
+#include "scene.hpp"
+#include "simulation_engine.hpp"
+
+// Field too large for one process, split into slabs of whole rows over the ranks of an MPI
+// communicator; every collective call has to be made by all of its ranks in the same order.
+//
+// The grid is the zero-padded FFT grid of WaveFront::propagate (n = N * guard), the field filling
+// its centre N x N: the guard band is cleared after every step, as the in-core crop does. Spectra
+// stay transposed between the forward and the inverse transform (FFTW_MPI_TRANSPOSED_OUT / _IN),
+// which saves two all-to-all exchanges per step. Cameras take only the window of the field their
+// region of interest covers, gathered on rank 0
+class DistributedWaveFront
+{
+private:
+    MPI_Comm comm;
+    int rank;
+    int N, n;                     // Field and FFT grid sizes
+    ptrdiff_t rows, firstRow;     // Grid rows this rank holds
+    ptrdiff_t columns, firstColumn; // Grid columns it holds of the transposed spectrum
+    double pixel_size, wavelength;
+    ray normal;
+    vec3 u, v, w; // Local frame, as WaveFront::get_LocalFrame sets it up
+    PooledBuffer Ex, Ey; // rows x n each
+    fftw_plan forward, inverse;
+
+    void clear();     // Zeroes this rank's rows
+    FieldSlab slab(); // This rank's rows
+
+public:
+    // N x N samples over the grid of shape (its size, axis and guard factor); collective
+    DistributedWaveFront(WaveFront &shape, int N, MPI_Comm comm);
+    ~DistributedWaveFront();
+    DistributedWaveFront(const DistributedWaveFront &) = delete;
+    DistributedWaveFront &operator=(const DistributedWaveFront &) = delete;
+
+    int getSize() const { return N; }
+    ray getNormal() const { return normal; }
+    size_t localBytes() const { return 2 * Ex.size() * sizeof(fftw_complex); } // Field memory of this rank
+    double fresnelNumber(double z) const { return z == 0.0 ? INF : N * pixel_size * pixel_size / (wavelength * std::abs(z)); } // As WaveFront::fresnelNumber
+
+    void initialize(const WaveFront &shape);  // Samples shape's source field on this rank's rows
+    void propagate(double z, bool exact);     // Fresnel (exact = false) or angular spectrum step; collective
+    bool interact(OpticalElement &element);   // Masks this rank's rows; false if the element needs the whole field
+    bool receive(Camera &camera);             // Adds the field to the camera and clears it; false if the sensor is tilted; collective
+};
+
+// Simulates the coherent paths of a scene on distributed N x N fields. Every rank reads the same
+// scene and follows the same paths; the cameras of rank 0 receive the results. Elements that need
+// the whole field (mirrors, tilted sensors) are reported as errors, and so is what
+// SimulationEngine::CheckFixedGrid refuses
+class DistributedSimulation
+{
+public:
+    static bool Run(Scene &scene, const SimulationSettings &settings, int N, MPI_Comm comm, std::string &error); // N = 0 keeps each source's sampling
+};
+
+#endif
+
+#endif
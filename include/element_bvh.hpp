@@ -0,0 +1,47 @@
+#ifndef ELEMENT_BVH_HPP
+#define ELEMENT_BVH_HPP
+
+#pragma once
+
+#include <vector>
+#include "optical_element.hpp"
+
+// Bounding-volume hierarchy over the elements' apertures, so finding the element a ray meets
+// first visits O(log n) boxes instead of calling hit() on every element. update() refits the
+// boxes of elements that moved or changed size and only rebuilds when the element list changes
+class ElementBVH
+{
+private:
+    struct Node
+    {
+        vec3 lo, hi;    // Bounds of everything below the node
+        int left = -1;  // Children (inner nodes); the right child is left + 1
+        int first = 0;  // Range of order[] (leaves)
+        int count = 0;
+    };
+
+    std::vector<OpticalElement *> elements;
+    std::vector<vec3> boxLo, boxHi; // Cached bounds of every element
+    std::vector<int> order;         // Element indices, grouped by leaf
+    std::vector<int> parent;        // Parent of every node, -1 for the root
+    std::vector<int> leafOf;        // Leaf holding every element
+    std::vector<Node> nodes;
+
+    static const int LEAF_SIZE = 2;
+
+    void build();
+    int buildNode(int index, int first, int count); // Fills nodes[index] with order[first, first + count)
+    void refit(int node);
+    static double slab(const Node &node, const point3 &p, const vec3 &inv, double limit); // Distance at which the ray enters the box, -1.0 if not before limit
+
+public:
+    void update(const std::vector<OpticalElement *> &list); // Rebuilds for a new element list, refits moved elements otherwise
+    size_t size() const { return elements.size(); }
+    OpticalElement *element(int index) const { return elements[index]; }
+
+    // Index of the element the ray hits first (as in the linear search: the closest hit() that
+    // is not -999.0), or -1; elements flagged in excluded and the one at skip are ignored
+    int closestHit(const ray &beamlet, double &dist, int skip = -1, const std::vector<char> *excluded = nullptr) const;
+};
+
+#endif
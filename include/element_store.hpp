@@ -0,0 +1,50 @@
+#ifndef ELEMENT_STORE_HPP
+#define ELEMENT_STORE_HPP
+
+#pragma once
+
+#include <variant>
+#include <vector>
+#include "lens.hpp"
+#include "mirror.hpp"
+#include "aperture.hpp"
+#include "camera.hpp"
+#include "ray_bundle.hpp"
+
+// Flat copy of the elements' ray-tracing data, one record per element in a contiguous array.
+// The nearest-hit search reads only the records (no pointer chasing, no virtual hit()), and
+// the interactions are dispatched statically on the concrete type held in the variant. Element
+// types without a kernel here are kept as OpticalElement and go through the virtual
+// hit_bundle() and interact_bundle(). The elements themselves stay the polymorphic facade:
+// build() has to be called again after any of them changes
+class ElementStore
+{
+public:
+    using Concrete = std::variant<ConvexLens *, ConcaveLens *, Mirror *, Iris *, Slit *, Camera *, OpticalElement *>; // The last one: any other element
+
+    struct Record
+    {
+        point3 centre;
+        vec3 normal;
+        vec3 a, b;     // In-plane axes of square apertures (the element's v and u)
+        double reach;  // Disc radius, or half the side of a square aperture
+        bool square;   // Mirrors and cameras
+        Concrete element;
+    };
+
+    void build(const std::vector<OpticalElement *> &list); // Record k describes list[k]
+    size_t size() const { return records.size(); }
+    const Record &record(int index) const { return records[index]; }
+
+    // For every live ray, the record it meets first other than last[i] (or -1) and the distance
+    // to it, by the rules of hit_bundle(); dead rays get -1 and a distance of -1.0. One fused pass over the rays per record replaces the
+    // separate intersection, clipping and minimum passes
+    void closestHits(const RayBundle &rays, const int *last, int *target, double *dist) const;
+    // interact_bundle() of the concrete element, called without a virtual dispatch for the known types
+    void interact(int index, RayBundle &rays, const std::vector<int> &indices) const;
+
+private:
+    std::vector<Record> records;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef FFT_PLANS_HPP
+#define FFT_PLANS_HPP
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <tuple>
+#include "fftw3.h"
+
+// Process-wide cache of FFTW plans keyed on the transform's shape, so a long-running process
+// plans every shape once. Plans are made on pooled scratch blocks and run on the caller's arrays
+// with fftw_execute_dft: those have to come from the buffer pool (fftw_malloc alignment) and be
+// the same array exactly when the plan is in place
+class FftPlans
+{
+private:
+    // rank, n, howmany, stride, dist, direction, in place
+    using Key = std::tuple<int, int, int, int, int, int, bool>;
+
+    std::mutex lock; // FFTW's planner is not thread-safe; executing a plan is
+    std::map<Key, fftw_plan> plans;
+    unsigned flags = FFTW_ESTIMATE;
+
+    FftPlans() = default;
+
+public:
+    ~FftPlans();
+    FftPlans(const FftPlans &) = delete;
+    FftPlans &operator=(const FftPlans &) = delete;
+
+    static FftPlans &instance();
+
+    // howmany transforms of n (rank 1) or n x n (rank 2) points, stride apart within a transform
+    // and dist apart from one to the next
+    fftw_plan get(int rank, int n, int howmany, int stride, int dist, int direction, bool inPlace);
+    fftw_plan get2D(int n, int direction, bool inPlace) { return get(2, n, 1, 1, n * n, direction, inPlace); }
+
+    void setPatient(bool patient); // FFTW_MEASURE instead of FFTW_ESTIMATE for shapes planned from now on
+    void clear();                  // Destroys every plan; none may be running
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef GAUSSIAN_BEAM_HPP
+#define GAUSSIAN_BEAM_HPP
+
+#pragma once
+
+#include "ray.hpp"
+#include "wavefront.hpp"
+#include "utils.hpp"
+#include <complex>
+
+class Source;
+
+// Analytic Gaussian, Laguerre-Gaussian or Hermite-Gaussian beam carried through paraxial
+// ABCD optics by its complex beam parameter q (1/q = 1/R + i lambda / (pi w^2))
+class GaussianBeam
+{
+private:
+    ray axis;              // Beam axis
+    FieldType mode;        // GAUSSIAN, LG or HG
+    int l, p;              // Mode indices
+    double wavelength;     // Wavelength of the beam
+    double w0;             // Waist at the source
+    double psi, delta;     // Polarization angle and relative phase
+    std::complex<double> q; // Complex beam parameter
+    double gouy;           // Accumulated Gouy phase of the fundamental mode
+    double pathLength;     // Distance travelled along the axis
+
+    int order() const; // Mode order entering the Gouy phase (m + n for HG, 2p + |l| for LG)
+    void applyABCD(double A, double B, double C, double D);
+
+public:
+    GaussianBeam(Source &src);
+
+    static bool supports(Source &src); // Whether the source's field is a mode this class can carry
+
+    ray getAxis() const { return axis; }
+    std::complex<double> getQ() const { return q; }
+    double getWidth() const;  // 1/e^2 intensity radius of the fundamental mode
+    double getExtent() const; // Radius outside which the mode carries negligible power
+
+    void propagate(double z);   // Free-space step along the axis
+    void applyLens(double f);   // Thin lens of focal length f (negative for diverging lenses)
+    bool reflect(vec3 n);       // Flat mirror with normal n; false for modes the mirror image changes (LG with l != 0, HG other than 00)
+
+    void samplingHint(double &half_width, double &max_angle) const; // Window and bandwidth needed to rasterize the beam
+    void rasterize(WaveFront &target) const;                       // Adds the field sampled on target's (parallel) grid
+};
+
+#endif
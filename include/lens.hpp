@@ -13,9 +13,16 @@ public:
     ConvexLens(vec3 position, vec3 orientation, std::string name, double diameter, double focal_length, double refractive_index);
 
     double hit(const ray &beamlet) override;
+    double apertureRadius() const override { return radius; }
     void interact_ray(ray &beamlet) override;
+    void hit_bundle(const RayBundle &rays, double *t) override;
+    void interact_bundle(RayBundle &rays, const std::vector<int> &indices) override;
     void interact_wavefront(WaveFront &A) override;
+    bool interact_slab(FieldSlab &slab) override;
+    bool interact_beam(GaussianBeam &beam) override;
+    double added_angle(double half_width, double wavelength) const override { return min(half_width, radius) / std::abs(focalLength); }
     void reset() override {};
+    std::shared_ptr<OpticalElement> clone() const override { return std::make_shared<ConvexLens>(*this); }
 
     void setRadius(double r) { radius = r; };
     void setFocalLength(double f) { focalLength = f; };
@@ -36,9 +43,16 @@ public:
     ConcaveLens(vec3 position, vec3 orientation, std::string name, double diameter, double focalLength, double refractive_index);
 
     double hit(const ray &beamlet) override;
+    double apertureRadius() const override { return radius; }
     void interact_ray(ray &beamlet) override;
+    void hit_bundle(const RayBundle &rays, double *t) override;
+    void interact_bundle(RayBundle &rays, const std::vector<int> &indices) override;
     void interact_wavefront(WaveFront &A) override;
+    bool interact_slab(FieldSlab &slab) override;
+    bool interact_beam(GaussianBeam &beam) override;
+    double added_angle(double half_width, double wavelength) const override { return min(half_width, radius) / std::abs(focalLength); }
     void reset() override {};
+    std::shared_ptr<OpticalElement> clone() const override { return std::make_shared<ConcaveLens>(*this); }
 
     void setRadius(double r) { radius = r; };
     void setFocalLength(double f) { focalLength = f; };
@@ -0,0 +1,34 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+// Scratch file mapped read-write into memory (CreateFileMapping on Windows, mmap elsewhere), for
+// data larger than RAM: the system pages it in and out on demand. The file is zero-filled, has no
+// name left on disk once created and is gone when the mapping closes
+class MappedFile
+{
+private:
+    long long handle = -1;    // Native file, -1 when closed
+    void *mapping = nullptr;  // Mapping object (Windows only)
+    char *view = nullptr;
+    size_t bytes = 0;
+
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool create(const std::string &directory, size_t bytes); // Empty directory: the system's temporary one; false if the disk has no room
+    void close();
+
+    bool isOpen() const { return view != nullptr; }
+    char *data() const { return view; }
+    size_t size() const { return bytes; }
+};
+
+#endif
@@ -26,9 +26,14 @@ public:
     void setRefractiveIndex(std::complex<double> new_RI) { refractive_index = new_RI; }
 
     double hit(const ray &beamlet) override;
+    double apertureRadius() const override { return size / std::sqrt(2.0); } // Corners of the square
     void interact_ray(ray &beamlet) override;
+    void hit_bundle(const RayBundle &rays, double *t) override;
+    void interact_bundle(RayBundle &rays, const std::vector<int> &indices) override;
     void interact_wavefront(WaveFront &A) override;
+    bool interact_beam(GaussianBeam &beam) override;
     void reset() override {}
+    std::shared_ptr<OpticalElement> clone() const override { return std::make_shared<Mirror>(*this); }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef NET_HPP
+#define NET_HPP
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <cstddef>
+
+// Minimal blocking TCP sockets (Winsock on Windows, BSD sockets elsewhere) for the headless
+// server and its clients. Connections are move-only and close themselves
+class Connection
+{
+private:
+    long long handle = -1; // Native socket, -1 when closed
+    std::string pending;   // Bytes received past the last line returned by readLine()
+    bool timed = false;    // Whether reads give up at deadline
+    std::chrono::steady_clock::time_point deadline;
+
+    long long receive(char *data, size_t bytes); // One recv(), bounded by the deadline; <= 0 on failure
+
+public:
+    Connection() = default;
+    explicit Connection(long long handle) : handle(handle) {}
+    ~Connection() { close(); }
+
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+    Connection(Connection &&other) noexcept;
+    Connection &operator=(Connection &&other) noexcept;
+
+    static Connection connect(const std::string &host, int port); // Closed connection on failure
+
+    bool isOpen() const { return handle != -1; }
+    void close();
+    void shutdown(); // Ends both directions but keeps the socket, waking a thread blocked on it from any other thread
+
+    bool sendAll(const void *data, size_t bytes);
+    bool sendLine(const std::string &line); // Appends the newline
+    bool readLine(std::string &line);       // Without the newline; false once the peer closed
+    bool readExactly(void *data, size_t bytes);
+    void setReadTimeout(int milliseconds); // Reads fail once this long has passed from now, however the data trickles in; 0 for no limit
+};
+
+class Listener
+{
+private:
+    long long handle = -1;
+
+public:
+    Listener() = default;
+    ~Listener() { close(); }
+    Listener(const Listener &) = delete;
+    Listener &operator=(const Listener &) = delete;
+
+    bool listen(int port, bool loopbackOnly = true); // Port 0 picks a free one, see getPort()
+    int getPort() const;
+    Connection accept(); // Blocks; closed connection once the listener is closed
+    void close();
+};
+
+bool NetStartup(); // Initializes the socket library (Winsock); harmless to call more than once
+
+#endif
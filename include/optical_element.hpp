@@ -10,6 +10,9 @@
 #include <string>
 #include <memory>
 
+class GaussianBeam;
+class RayBundle;
+
 class OpticalElement
 {
 private:
@@ -32,9 +35,18 @@ public:
     void init_local_frame();
 
     virtual double hit(const ray &beamlet) = 0;
+    virtual double apertureRadius() const = 0;     // Radius about the position of a disc in the element's plane containing everything hit() can return
+    void getBounds(vec3 &lo, vec3 &hi) const;      // Axis-aligned box around that disc
     virtual void interact_ray(ray &beamlet) = 0;
+    virtual void hit_bundle(const RayBundle &rays, double *t);                         // hit() for every ray of the bundle, written to t
+    virtual void interact_bundle(RayBundle &rays, const std::vector<int> &indices); // interact_ray() for the listed rays, which lie on the element
     virtual void interact_wavefront(WaveFront &A) = 0;
+    virtual bool interact_slab(FieldSlab &slab) { return false; } // Masks the rows of a field the slab holds; false if the element needs the whole field
+    virtual void receive_wavefront(WaveFront &A, double distance); // Propagates A onto the element and interacts with it
+    virtual double added_angle(double half_width, double wavelength) const { return 0.0; } // Largest deflection the element imposes within half_width of the beam axis
+    virtual bool interact_beam(GaussianBeam &beam) { return false; }                        // Acts on an analytic beam; false if the field has to be sampled instead
     virtual void reset() = 0;
+    virtual std::shared_ptr<OpticalElement> clone() const = 0; // Independent copy, used to simulate snapshots of a scene
 };
 
 #endif
\ No newline at end of file
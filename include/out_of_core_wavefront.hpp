@@ -0,0 +1,63 @@
+#ifndef OUT_OF_CORE_WAVEFRONT_HPP
+#define OUT_OF_CORE_WAVEFRONT_HPP
+
+#pragma once
+
+#include <string>
+#include "camera.hpp"
+#include "mapped_file.hpp"
+#include "scene.hpp"
+#include "simulation_engine.hpp"
+
+// Field too large for memory, held in two memory-mapped scratch files (Ex and Ey) that the system
+// pages to disk. Only a work buffer of a set budget is allocated: propagation streams blocks of
+// rows and then blocks of column pencils through it, one 1D FFT pass per direction, so the file
+// is read about three times per step and always in runs of whole rows or block-wide row segments.
+//
+// The grid is the zero-padded FFT grid of WaveFront::propagate (n = N * guard), the field filling
+// its centre N x N; guard rows are known to be zero and skip their transforms. Cameras take only
+// the window of the field their region of interest covers
+class OutOfCoreWaveFront
+{
+private:
+    int N, n;     // Field and FFT grid sizes
+    int block;    // Rows of a row block and columns of a column block; divides n
+    double pixel_size, wavelength;
+    ray normal;
+    vec3 u, v, w;       // Local frame, as WaveFront::get_LocalFrame sets it up
+    MappedFile Ex, Ey;  // n x n each, row-major
+
+    static std::complex<double> *grid(const MappedFile &file) { return reinterpret_cast<std::complex<double> *>(file.data()); }
+    FieldSlab slab(int first, int count);                     // Rows [first, first + count), straight from the files
+    void transformRows(MappedFile &file, int direction);      // Centring and forward row FFTs, or inverse row FFTs and the crop
+    void filterColumns(MappedFile &file, const TransferFunction &H); // Column FFTs, the transfer function and inverse column FFTs
+
+public:
+    // N x N samples over the grid of shape (its size, axis and guard factor); the files go to
+    // scratchDir (empty: the temporary directory) and the work buffer takes budgetBytes
+    OutOfCoreWaveFront(WaveFront &shape, int N, const std::string &scratchDir, size_t budgetBytes);
+    OutOfCoreWaveFront(const OutOfCoreWaveFront &) = delete;
+    OutOfCoreWaveFront &operator=(const OutOfCoreWaveFront &) = delete;
+
+    bool isOpen() const { return Ex.isOpen() && Ey.isOpen(); } // False if the scratch files could not be created
+    int getSize() const { return N; }
+    ray getNormal() const { return normal; }
+    size_t gridBytes() const { return (size_t)n * n * sizeof(fftw_complex); } // Size of each of the two files
+    double fresnelNumber(double z) const { return z == 0.0 ? INF : N * pixel_size * pixel_size / (wavelength * std::abs(z)); } // As WaveFront::fresnelNumber
+
+    void initialize(const WaveFront &shape); // Samples shape's source field
+    void propagate(double z, bool exact);    // Fresnel (exact = false) or angular spectrum step
+    bool interact(OpticalElement &element);  // Masks the field block by block; false if the element needs the whole field
+    bool receive(Camera &camera);            // Adds the field to the camera; false if the sensor is tilted
+};
+
+// Simulates the coherent paths of a scene on out-of-core N x N fields, one path at a time. Elements
+// that need the whole field (mirrors, tilted sensors) are reported as errors, and so is what
+// SimulationEngine::CheckFixedGrid refuses
+class OutOfCoreSimulation
+{
+public:
+    static bool Run(Scene &scene, const SimulationSettings &settings, int N, const std::string &scratchDir, size_t budgetBytes, std::string &error); // N = 0 keeps each source's sampling
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef PROGRESSIVE_SIMULATION_HPP
+#define PROGRESSIVE_SIMULATION_HPP
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "scene.hpp"
+#include "simulation_engine.hpp"
+
+// Coarse-to-fine preview of a scene on a background thread. Each request snapshots the scene and
+// simulates it with the source grids and camera resolutions divided by 8, 4, 2 and finally 1;
+// every finished level replaces the previous one on the cameras (a level whose grids come out the
+// same as the next one's is skipped). A new request cancels the level in progress at its next
+// propagation step, so only the latest state of the scene is refined
+class ProgressiveSimulation
+{
+public:
+    static constexpr int LEVELS[] = {8, 4, 2, 1}; // Resolution divisors, coarsest first
+
+    ProgressiveSimulation();
+    ~ProgressiveSimulation();
+    ProgressiveSimulation(const ProgressiveSimulation &) = delete;
+    ProgressiveSimulation &operator=(const ProgressiveSimulation &) = delete;
+
+    void Request(const Scene &scene, const SimulationSettings &settings); // Restarts the refinement from the coarsest level
+    void Stop();                                                          // Drops pending work and waits until the worker is idle
+    bool Collect(Scene &scene);                                           // Stores the newest finished level in the scene's cameras; true if there was one
+
+    bool isRefining();                           // A level is being computed or waiting to be
+    int getDivisor() const { return shownDivisor; } // Divisor of the level last collected, 0 if none
+
+private:
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake; // Signalled on a new request or shutdown
+    std::condition_variable idle; // Signalled when the worker finishes or abandons a request
+    std::atomic<bool> cancel{false};
+
+    std::unique_ptr<Scene> pending; // Snapshot waiting for the worker
+    SimulationSettings pendingSettings;
+    bool busy = false;
+    bool quit = false;
+
+    std::vector<std::pair<int, WaveFront>> readyFields; // Camera object id -> sensed field of the newest level
+    int readyDivisor = 0;                               // 0 while nothing new is ready
+    int shownDivisor = 0;
+
+    void Work();
+    void Refine(const Scene &base, const SimulationSettings &settings);
+    static std::unique_ptr<Scene> Level(const Scene &base, int divisor, std::vector<int> &grids); // Snapshot at one divisor; grids gets its source sizes and camera resolutions
+};
+
+#endif
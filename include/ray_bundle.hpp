@@ -0,0 +1,31 @@
+#ifndef RAY_BUNDLE_HPP
+#define RAY_BUNDLE_HPP
+
+#pragma once
+
+#include <vector>
+#include "ray.hpp"
+#include "vec3.hpp"
+
+// Many rays stored as a structure of arrays, so the per-element kernels stream through
+// contiguous coordinates (and vectorize) instead of calling hit()/interact_ray() ray by ray
+class RayBundle
+{
+public:
+    std::vector<double> px, py, pz;   // Positions
+    std::vector<double> dx, dy, dz;   // Unit directions
+    std::vector<unsigned char> alive; // Cleared once a ray is absorbed, blocked or leaves the scene
+
+    size_t size() const { return px.size(); }
+    void reserve(size_t n);
+    void add(const point3 &pos, const vec3 &dir);
+    ray get(size_t i) const;
+    void set(size_t i, const ray &r); // Position and direction only
+
+    void intersectPlane(const point3 &point, const vec3 &normal, double *t) const;                       // Distance to the plane along every ray; -999.0 if dead, parallel or behind
+    void clipDisc(const point3 &centre, double radius, double *t) const;                                 // Sets t to -999.0 where the hit point lies outside the disc
+    void clipSquare(const point3 &centre, const vec3 &a, const vec3 &b, double half_size, double *t) const; // Same for the square spanned by a and b
+    void propagate(const std::vector<int> &indices, const double *t);                                     // Moves the listed rays by their t
+};
+
+#endif
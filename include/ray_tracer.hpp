@@ -0,0 +1,31 @@
+#ifndef RAY_TRACER_HPP
+#define RAY_TRACER_HPP
+
+#pragma once
+
+#include <vector>
+#include "scene.hpp"
+#include "ray_bundle.hpp"
+#include "element_store.hpp"
+
+struct RayTraceSettings
+{
+    int raysPerSource = 100000; // Rays launched across each source's beam
+    int maxBounces = 64;        // Interactions after which a ray is given up on
+};
+
+// Geometric-optics mode: traces bundles of rays from every source through the scene with the
+// elements' kernels and leaves a spot diagram on each camera
+class RayTracer
+{
+public:
+    static size_t Trace(Scene &scene, const RayTraceSettings &settings = RayTraceSettings()); // Returns the number of rays launched
+
+private:
+    static const int BVH_MIN_ELEMENTS = 64; // Scenes up to this size test every record of the store instead of traversing the BVH
+
+    static RayBundle Emit(Source &src, int count);
+    static void Propagate(RayBundle &rays, const ElementBVH &bvh, const ElementStore &store, int maxBounces);
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include <memory>
 #include <vector>
 #include <algorithm>
+#include <unordered_map>
 
 #include "optical_element.hpp"
 #include "source.hpp"
@@ -13,12 +14,35 @@
 #include "mirror.hpp"
 #include "lens.hpp"
 #include "aperture.hpp"
+#include "element_bvh.hpp"
+
+enum class ElementKind
+{
+    SOURCE,
+    CAMERA,
+    MIRROR,
+    CONVEX_LENS,
+    CONCAVE_LENS,
+    IRIS,
+    SLIT,
+    COUNT // Number of kinds; also returned for unknown type names
+};
+
+inline ElementKind ParseElementKind(const std::string &type)
+{
+    static const char *names[] = {"Source", "Camera", "Mirror", "ConvexLens", "ConcaveLens", "Iris", "Slit"};
+    for (int k = 0; k < (int)ElementKind::COUNT; k++)
+        if (type == names[k])
+            return (ElementKind)k;
+    return ElementKind::COUNT;
+}
 
 struct SceneObject
 {
     int id;
     std::string name;
     std::string type;
+    ElementKind kind; // Parsed from type once, so per-frame code can switch on it
 
     std::shared_ptr<Source> source = nullptr;
     std::shared_ptr<OpticalElement> element = nullptr;
@@ -42,56 +66,93 @@ class Scene
 private:
     std::vector<std::shared_ptr<SceneObject>> objects;
     int nextID = 1;
+    ElementBVH bvh; // Over GetSimulationElements(), brought up to date by GetElementBVH()
+
+    std::vector<SceneObject *> byKind[(int)ElementKind::COUNT]; // Objects of every kind, in insertion order
+    std::unordered_map<int, std::shared_ptr<SceneObject>> byID;
+
+    void Index(const std::shared_ptr<SceneObject> &obj)
+    {
+        objects.push_back(obj);
+        byID[obj->id] = obj;
+        if (obj->kind != ElementKind::COUNT)
+            byKind[(int)obj->kind].push_back(obj.get());
+    }
 
 public:
     std::shared_ptr<SceneObject> selectedObject = nullptr;
 
-    void AddObject(const std::string &type, vec3 position, vec3 orientation)
+    std::shared_ptr<SceneObject> AddObject(const std::string &type, vec3 position, vec3 orientation)
     {
         auto obj = std::make_shared<SceneObject>();
         obj->id = nextID++;
         obj->type = type;
+        obj->kind = ParseElementKind(type);
         obj->name = type + " " + std::to_string(obj->id);
         obj->uiPosition = position;
         obj->uiOrientation = orientation;
 
-        if (type == "Source")
+        switch (obj->kind)
         {
+        case ElementKind::SOURCE:
             obj->source = std::make_shared<Source>(position, orientation, FieldType::GAUSSIAN, 0, 0);
-        }
-        else if (type == "Camera")
-        {
+            break;
+        case ElementKind::CAMERA:
             obj->element = std::make_shared<Camera>(position, orientation, obj->name);
-        }
-        else if (type == "Mirror")
-        {
+            break;
+        case ElementKind::MIRROR:
             obj->element = std::make_shared<Mirror>(position, orientation, obj->name);
-        }
-        else if (type == "ConvexLens")
-        {
+            break;
+        case ElementKind::CONVEX_LENS:
             obj->element = std::make_shared<ConvexLens>(position, orientation, obj->name, 0.02, 0.1, 1.5);
-        }
-        else if (type == "ConcaveLens")
-        {
+            break;
+        case ElementKind::CONCAVE_LENS:
             obj->element = std::make_shared<ConcaveLens>(position, orientation, obj->name, 0.02, 0.1, 1.5);
-        }
-        else if (type == "Iris")
-        {
+            break;
+        case ElementKind::IRIS:
             obj->element = std::make_shared<Iris>(position, orientation, obj->name, 0.01, 0.02);
+            break;
+        case ElementKind::SLIT:
+            obj->element = std::make_shared<Slit>(position, orientation, obj->name, 0.02, 0.01, 1e-4, 1, 2e-4);
+            break;
+        default:
+            break;
         }
-        else if (type == "Slit")
+
+        Index(obj);
+        return obj;
+    }
+
+    void RemoveObject(int id)
+    {
+        auto found = byID.find(id);
+        if (found == byID.end())
+            return;
+        std::shared_ptr<SceneObject> obj = found->second;
+        byID.erase(found);
+        if (obj->kind != ElementKind::COUNT)
         {
-            obj->element = std::make_shared<Slit>(position, orientation, obj->name, 0.02, 0.01, 1e-4, 1, 2e-4);
+            auto &list = byKind[(int)obj->kind];
+            list.erase(std::find(list.begin(), list.end(), obj.get()));
         }
+        objects.erase(std::find(objects.begin(), objects.end(), obj));
+        if (selectedObject == obj)
+            selectedObject = nullptr;
+    }
 
-        objects.push_back(obj);
+    SceneObject *Find(int id) const
+    {
+        auto found = byID.find(id);
+        return found == byID.end() ? nullptr : found->second.get();
     }
 
+    const std::vector<SceneObject *> &GetObjectsOfKind(ElementKind kind) const { return byKind[(int)kind]; }
+
     void ClearSelection()
     {
+        if (selectedObject)
+            selectedObject->isSelected = false;
         selectedObject = nullptr;
-        for (auto &obj : objects)
-            obj->isSelected = false;
     }
 
     std::vector<OpticalElement *> GetSimulationElements()
@@ -105,6 +166,12 @@ public:
         return list;
     }
 
+    ElementBVH &GetElementBVH()
+    {
+        bvh.update(GetSimulationElements());
+        return bvh;
+    }
+
     std::vector<Source *> GetActiveSource()
     {
         std::vector<Source *> list;
@@ -119,32 +186,58 @@ public:
     std::vector<OpticalElement *> GetCameras()
     {
         std::vector<OpticalElement *> list;
-        for (auto &obj : objects)
-        {
-            if (obj->type == "Camera")
-                list.push_back(obj->element.get());
-        }
+        for (auto obj : byKind[(int)ElementKind::CAMERA])
+            list.push_back(obj->element.get());
+        return list;
+    }
+
+    std::vector<Camera *> GetSensors() // GetCameras() with their concrete type
+    {
+        std::vector<Camera *> list;
+        for (auto obj : byKind[(int)ElementKind::CAMERA])
+            list.push_back(static_cast<Camera *>(obj->element.get()));
         return list;
     }
 
     void Clear()
     {
         objects.clear();
+        byID.clear();
+        for (auto &list : byKind)
+            list.clear();
         selectedObject = nullptr;
         nextID = 1;
     }
 
     void Select(int id)
     {
+        ClearSelection();
+        auto found = byID.find(id);
+        if (found == byID.end())
+            return;
+        selectedObject = found->second;
+        selectedObject->isSelected = true;
+    }
+
+    // Deep copy that can be simulated independently of this scene; object ids are kept
+    Scene Snapshot() const
+    {
+        Scene copy;
+        copy.nextID = nextID;
         for (auto &obj : objects)
         {
-            obj->isSelected = (obj->id == id);
-            if (obj->isSelected)
-                selectedObject = obj;
+            auto dup = std::make_shared<SceneObject>(*obj);
+            dup->isSelected = false;
+            if (obj->source)
+                dup->source = std::make_shared<Source>(*obj->source);
+            if (obj->element)
+                dup->element = obj->element->clone();
+            copy.Index(dup);
         }
+        return copy;
     }
 
-    std::vector<std::shared_ptr<SceneObject>> &GetObjects() { return objects; }
+    const std::vector<std::shared_ptr<SceneObject>> &GetObjects() const { return objects; } // Add and remove through the Scene so the indices stay valid
 };
 
 #endif
\ No newline at end of file
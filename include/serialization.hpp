@@ -0,0 +1,43 @@
+#ifndef SERIALIZATION_HPP
+#define SERIALIZATION_HPP
+
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include "scene.hpp"
+#include "simulation_engine.hpp"
+
+// Plain-text scene descriptions, one object per line:
+//
+//   <Type> <x> <y> <z> <ox> <oy> <oz> [key=value ...]
+//
+// Type is an element registry id (Source, Camera, Mirror, ConvexLens, ConcaveLens, Iris, Slit),
+// lengths are in metres and keys left out keep the defaults of AddObject. A line
+// "Settings adaptive=0|1 analytic=0|1" sets the simulation switches; blank lines and lines
+// starting with # are ignored. Keys per type:
+//
+//   Source       field=plane|gaussian|lg|hg wavelength waist l p psi delta guard
+//                bandwidth samples coherence threshold modes
+//   Camera       size resolution roi roix roiy zoom
+//   Mirror       size reflectivity n k
+//   ConvexLens,
+//   ConcaveLens  diameter focal n
+//   Iris         size radius
+//   Slit         size width height count separation
+//
+// Keys that size the grids or the work of a run are bounded: resolution 8192, samples 256,
+// guard 4 and |l|, |p| 100; larger values are errors. So is a partially coherent source whose
+// retained modes leave out more than 20% of its power
+bool ReadScene(std::istream &in, Scene &scene, SimulationSettings &settings, std::string &error); // Adds the objects to scene; false with a message naming the line on errors
+void WriteScene(std::ostream &out, Scene &scene, const SimulationSettings &settings);            // Description that ReadScene turns back into the same setup
+
+// Binary field format: the 8 bytes "OSLFIELD", uint32 version (1), uint32 N, float64 pixel
+// size, float64 wavelength, then Ex and Ey as N x N row-major complex float64 (re, im) pairs,
+// all in the byte order of the writing machine
+void WriteField(std::ostream &out, WaveFront &field);
+size_t FieldBytes(int N); // Size WriteField produces for an N x N field
+void WriteCameraFields(std::ostream &out, Scene &scene); // Every camera's field as a line "CAMERA <id> <bytes>" and its WriteField record, like the server's reply
+
+#endif
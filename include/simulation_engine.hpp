@@ -3,16 +3,27 @@
 
 #pragma once
 
+#include <atomic>
+#include <string>
 #include <vector>
 #include <set>
 #include "scene.hpp"
 
+class GaussianBeam;
+
+struct SimulationSettings
+{
+    bool adaptiveSampling = true; // Resample the wavefront between elements to fit the beam's extent and bandwidth
+    bool analyticBeams = true;    // Carry Gaussian, LG and HG sources analytically until an element needs the sampled field
+    int batchSize = 16;           // Members of a broadband or partially coherent source propagated (and held in memory) together; a batched step holds about 2 * batchSize padded n x n grids
+    const std::atomic<bool> *cancel = nullptr; // Checked between propagation steps; Run returns early once it is set
+};
+
 class SimulationEngine
 {
 public:
-    static std::vector<OpticalElement *> Run(Scene &scene);
+    static std::vector<OpticalElement *> Run(Scene &scene, const SimulationSettings &settings = SimulationSettings());
 
-private:
     struct Path
     {
         Source* source = nullptr;
@@ -28,6 +39,21 @@ private:
         }
     };
 
+    static std::set<Path> FindPaths(Scene &scene); // Element sequences the rays of each active source meet
+
+    // What runs on one fixed grid (out-of-core and distributed, named by backend) cannot do, as
+    // errors: analytic beams, adaptive sampling and batched sources, which Run handles with
+    // changes of grid; and far-field steps (Fresnel number below 1 under AUTO, or a source
+    // forcing FRESNEL_SINGLE_FFT), whose transfer function the fixed grid undersamples
+    static bool CheckFixedGrid(const SimulationSettings &settings, const Path &path, const std::string &backend, std::string &error);
+    static bool CheckFixedGridStep(const Path &path, const OpticalElement &element, double distance, double fresnelNumber, const std::string &backend, std::string &error);
+
+private:
+    struct Arrival; // A batch member's field (or analytic beam) just in front of the camera ending its path
+
+    static size_t TraceAnalytic(const Path &path, WaveFront &E_field, const SimulationSettings &settings, GaussianBeam &beam, size_t begin, size_t end, bool &through);
+    static void PropagatePath(const Path &path, WaveFront &E_field, size_t start, size_t end, const SimulationSettings &settings);
+    static void PropagateBatch(const Path &path, std::vector<Source> &members, const SimulationSettings &settings, std::vector<Arrival> &arrivals);
     static std::vector<double> FlattenGrid(const std::vector<std::vector<double>> &grid, int N);
 };
 
@@ -0,0 +1,59 @@
+#ifndef SIMULATION_SERVER_HPP
+#define SIMULATION_SERVER_HPP
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "net.hpp"
+#include "scene.hpp"
+#include "simulation_engine.hpp"
+
+// Headless mode: accepts scene descriptions (see serialization.hpp) over TCP, by default on the
+// loopback interface only, queues them and runs them one after another in this warm process,
+// so the buffer pool and the rest of the process state carry over from job to job. Protocol,
+// one job per connection:
+//
+//   client: SIMULATE <bytes>\n<scene description of that many bytes>
+//   server: QUEUED <jobs ahead>\n                             (or ERROR <message>\n and close)
+//           OK <cameras>\n, then per camera CAMERA <id> <bytes>\n<binary field of that many bytes>
+//
+// Jobs run on a single worker: the FFTW planner is not thread-safe, and every job already
+// spreads its grid loops over all cores
+class SimulationServer
+{
+private:
+    struct Job
+    {
+        Connection client;
+        std::unique_ptr<Scene> scene;
+        SimulationSettings settings;
+    };
+
+    Listener listener;
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<Job> queue;
+    bool running = false; // Whether a job is being simulated
+    bool quit = false;
+    size_t completed = 0;
+
+    void Work();
+    void Receive(Connection client); // Reads one request and queues it or answers with an error
+    static void Reply(Job &job);
+
+public:
+    ~SimulationServer() { Stop(); }
+
+    bool Start(int port, bool loopbackOnly = true); // Listens on port (0 for any free one) and starts the worker
+    int getPort() const { return listener.getPort(); }
+    void Serve();          // Accepts connections until Stop()
+    void Stop();           // Ends Serve(), finishes the running job and rejects the queued ones
+    size_t getCompleted(); // Jobs answered so far
+};
+
+#endif
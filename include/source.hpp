@@ -8,6 +8,7 @@
 #include "utils.hpp"
 #include "vec3.hpp"
 #include "wavefront.hpp"
+#include <vector>
 
 class Source
 {
@@ -20,6 +21,11 @@ private:
     double wavelength;
     double w0;
     int l, p;
+    double bandwidth = 0.0;  // FWHM of the Gaussian emission spectrum, 0 for a monochromatic source
+    int spectralSamples = 7; // Wavelengths a broadband spectrum is sampled at
+    double coherenceWidth = 0.0; // RMS transverse coherence length of a Gaussian Schell-model source, 0 for a coherent one
+    double modeThreshold = 0.01; // Coherent modes weaker than this fraction of the fundamental are dropped
+    int maxModes = 136;          // Hard limit on the retained modes (whole orders, 136 = orders 0 to 15)
 
 public:
     WaveFront E;
@@ -38,6 +44,20 @@ public:
     double getBeamWaist() { return w0; }
     int getL() { return l; }
     int getP() { return p; }
+    double getGuardFactor() { return E.getGuardFactor(); }
+    double getBandwidth() const { return bandwidth; }
+    int getSpectralSamples() const { return spectralSamples; }
+    bool isBroadband() const { return bandwidth > 0.0 && spectralSamples > 1; }
+
+    double getCoherenceWidth() const { return coherenceWidth; }
+    double getModeThreshold() const { return modeThreshold; }
+    int getMaxModes() const { return maxModes; }
+    bool isPartiallyCoherent() const { return coherenceWidth > 0.0 && mode == FieldType::GAUSSIAN; }
+    bool isBatched() const { return isBroadband() || isPartiallyCoherent(); } // Simulated as a set of mutually incoherent members
+
+    void sampleSpectrum(std::vector<double> &wavelengths, std::vector<double> &weights) const;   // Sampled wavelengths and their power fractions
+    void sampleModes(std::vector<int> &m, std::vector<int> &n, std::vector<double> &weights, double &waist, double &dropped) const; // HG modes of the Gaussian Schell-model field and the fraction of its power left out
+    void batchMembers(std::vector<Source> &members, std::vector<double> &weights) const;          // Coherent sources whose intensities add up to this source's
 
     void setPosition(vec3 pos)
     {
@@ -87,6 +107,36 @@ public:
         p = P;
         E.setBeamMode(L, P);
     }
+
+    void setGuardFactor(double g)
+    {
+        E.setGuardFactor(g);
+    }
+
+    void setBandwidth(double fwhm)
+    {
+        bandwidth = min(max(fwhm, 0.0), 0.5 * wavelength); // Keeps the shortest sampled wavelength above half the centre one
+    }
+
+    void setSpectralSamples(int k)
+    {
+        spectralSamples = max(1, k);
+    }
+
+    void setCoherenceWidth(double sigma)
+    {
+        coherenceWidth = max(sigma, 0.0);
+    }
+
+    void setModeThreshold(double t)
+    {
+        modeThreshold = min(max(t, 1e-4), 1.0);
+    }
+
+    void setMaxModes(int count)
+    {
+        maxModes = min(max(count, 1), 1035); // Up to order 44
+    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,105 @@
+#ifndef SWEEP_COORDINATOR_HPP
+#define SWEEP_COORDINATOR_HPP
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "net.hpp"
+
+// Parameter sweep over a scene description (see serialization.hpp). Lines of the form
+//
+//   Sweep <object> <key> <value> [value ...]
+//   Sweep <object> <key> range <first> <last> <count>
+//
+// vary the parameter key of the object-th object of the description (counting from 1 in order,
+// which is also the id ReadScene gives it); every other line is the base scene. The sweep runs
+// every combination of the axes' values, the last axis varying fastest
+struct SweepAxis
+{
+    int object;
+    std::string key;
+    std::vector<std::string> values;
+};
+
+struct SweepSpec
+{
+    std::string text;               // The description as read, stored in the archive
+    std::vector<std::string> lines; // Base scene
+    std::vector<int> objectLine;    // Line of every object (object k at objectLine[k - 1])
+    std::vector<SweepAxis> axes;
+
+    size_t jobCount() const;
+    std::string jobScene(size_t job) const; // Base scene with the job's values appended to their objects' lines
+    std::string jobLabel(size_t job) const; // "object:key=value ..." for the job
+};
+
+bool ReadSweep(std::istream &in, SweepSpec &spec, std::string &error);
+
+// Shards a sweep across simulation servers (OpticalSimulationLab --serve) on any hosts:
+// - each worker pulls the next job as soon as it is free, and once the queue is empty idle
+//   workers take a second copy of a job still running elsewhere, so a slow or stalled host
+//   does not hold up the end of the sweep (the first result wins, and the connections of the
+//   other copies are shut down so their drivers move on)
+// - jobs of a worker that fails go back to the queue; the worker retries a few times
+// - results are appended to one archive file and every finished job is recorded, with the
+//   archive's size after it, in a checkpoint file. Running the same sweep again with the same
+//   files truncates the archive to the last recorded job and continues with the rest; the
+//   checkpoint is read up to its first torn or inconsistent line
+//
+// Archive format: "OSLSWEEP 1\n", "SPEC <bytes>\n" and the sweep description, then one record
+// per camera and job: "RESULT <job> <camera id> <bytes> <label>\n" followed by the field in the
+// binary field format
+class SweepCoordinator
+{
+public:
+    struct Worker
+    {
+        std::string host;
+        int port;
+    };
+
+    static bool ParseWorkers(const std::string &list, std::vector<Worker> &workers, std::string &error); // "host:port,host:port,..."
+
+    // Runs the jobs not yet in the checkpoint; false if the files do not match the sweep, cannot be
+    // written (the jobs finished so far stay checkpointed) or jobs remain undone because every
+    // worker failed
+    bool Run(const SweepSpec &spec, const std::vector<Worker> &workers, const std::string &archivePath, const std::string &checkpointPath, std::string &error);
+
+    size_t getCompleted() const { return completed; } // Jobs whose results are in the archive
+    size_t getFailed() const { return failed; }       // Jobs the servers rejected
+
+private:
+    enum class JobState
+    {
+        QUEUED,
+        RUNNING,
+        DONE
+    };
+
+    const SweepSpec *spec = nullptr;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<size_t> queue;
+    std::vector<JobState> state;
+    std::vector<int> runners; // Workers currently simulating each job
+    std::vector<std::vector<Connection *>> links; // Their open connections, cut off once another copy finishes
+    size_t remaining = 0;     // Jobs not DONE
+    size_t completed = 0, failed = 0;
+    bool writeFailed = false; // The archive or checkpoint could not be written; the sweep stops
+    std::fstream archive;
+    std::ofstream checkpoint;
+
+    bool Resume(const std::string &archivePath, const std::string &checkpointPath, std::string &error);
+    bool Next(size_t &job); // Blocks until there is a job to run; false once all are done or the sweep failed
+    bool Attach(size_t job, Connection &server); // Registers the connection running job; false if the job is already done
+    bool Finish(size_t job, Connection &server, bool succeeded, bool rejected, const std::vector<std::pair<int, std::string>> &fields); // False if another copy finished job first
+    void Drive(Worker worker);
+};
+
+#endif
@@ -36,5 +36,8 @@ inline double factorial(int n)
 
 double genLaguerre(int p, int l, double x);
 double hermitePol(int n, double x);
+double hermiteFunction(int n, double x); // H_n(x) e^{-x^2/2} / sqrt(2^n n!), from a recursion that stays finite at any order
+inline double hermiteLogNorm(int n) { return n * std::log(2.0) + std::lgamma(n + 1.0); } // log(2^n n!), the squared norm hermiteFunction divides out
+int nextFastFFTSize(int n); // Smallest even size >= n of the form 2^a 3^b 5^c 7^d
 
 #endif
\ No newline at end of file
@@ -6,8 +6,72 @@
 #include "ray.hpp" // for beam axis
 #include <complex> // for Complex Electric Field amplitudes
 #include <vector>  // for Grids
+#include <memory>  // for shared grid storage
 #include "fftw3.h" // for Fourier Transform
 
+class PooledBuffer;
+class FieldSum;
+struct FieldSlab;
+
+enum class PropagationMethod
+{
+    AUTO,              // Chooses between the two below from the Fresnel number of the step
+    FRESNEL,           // Paraxial Fresnel transfer function
+    ANGULAR_SPECTRUM,  // Exact, band-limited angular spectrum transfer function (near field)
+    FRESNEL_SINGLE_FFT // Single-FFT Fresnel transform, rescales the grid pitch to lambda*z/(N*dx) (far field)
+};
+
+struct BeamMoments
+{
+    double power = 0.0;          // Total power (both components)
+    double cx = 0.0, cy = 0.0;   // Centroid
+    double tx = 0.0, ty = 0.0;   // Mean propagation angle
+    double xx = 0.0, yy = 0.0;   // Variance of the position
+    double xt = 0.0, yt = 0.0;   // Position-angle covariance
+    double ttx = 0.0, tty = 0.0; // Variance of the angle
+};
+
+// N x N grid of complex amplitudes with copy-on-write storage: copies of a wavefront share their
+// grids until one of them writes. Indexing only reads; writers take write() (or replace()) once,
+// before any parallel loop, since detaching is not thread-safe
+class FieldGrid
+{
+public:
+    typedef std::vector<std::vector<std::complex<double>>> Rows;
+
+private:
+    std::shared_ptr<Rows> rows = std::make_shared<Rows>();
+
+public:
+    const Rows &read() const { return *rows; }
+    Rows &write()
+    {
+        if (rows.use_count() > 1)
+            rows = std::make_shared<Rows>(*rows);
+        return *rows;
+    }
+    Rows &replace() // For writers that overwrite every pixel: detaches without copying the shared values
+    {
+        if (rows.use_count() > 1)
+            assign(rows->size());
+        return *rows;
+    }
+    void assign(size_t n) { rows = std::make_shared<Rows>(n, std::vector<std::complex<double>>(n, {0.0, 0.0})); }
+    bool sharedWith(const FieldGrid &other) const { return rows == other.rows; }
+
+    size_t size() const { return rows->size(); }
+    const std::vector<std::complex<double>> &operator[](size_t i) const { return (*rows)[i]; }
+    Rows::const_iterator begin() const { return rows->begin(); }
+    Rows::const_iterator end() const { return rows->end(); }
+};
+
+struct FieldStatistics
+{
+    double minIntensity = 0.0; // Extremes of the values Intensity() returns
+    double maxIntensity = 0.0;
+    double power = 0.0; // Integral of |Ex|^2 + |Ey|^2 over the grid
+};
+
 class WaveFront
 {
 private:
@@ -20,47 +84,166 @@ private:
     double delta;      // Relative phase difference
     double w0;         // Beam specific parameters
     int l, p;
+    PropagationMethod method = PropagationMethod::AUTO; // Method used by propagate()
+    double guard = 1.0;                                 // Zero-padding factor applied to the grid during convolution steps
+
+    // Everything initialize() depends on; the grids hold that field while it matches
+    struct FieldKey
+    {
+        FieldType source;
+        double psi, delta, wavelength, w0;
+        int l, p, N;
+        double pixel_size;
+        vec3 dir; // Only LG fields depend on the direction
+        bool operator==(const FieldKey &other) const;
+    };
+    FieldKey initializedKey;
+    bool keyValid = false; // Cleared whenever the grids are reallocated
+    FieldKey fieldKey() const;
 
     inline int idx(int i, int j) const { return i * N + j; }
 
+    void resizeGrid(); // Rounds N up to an FFT-friendly size and reallocates the (zeroed) grids
+    int paddedSize() const; // FFT size used by convolution steps, N enlarged by the guard factor
+
+    void embedCentred(const std::vector<std::vector<std::complex<double>>> &A, fftw_complex *buf, int n) const;             // Centres A in a zero padded n x n FFT buffer
+    void extractCentred(const fftw_complex *buf, int n, double norm, FieldGrid &grid) const;                            // Inverse of embedCentred, scaled by norm
+    PooledBuffer transferFunction(double z, bool exact, int n) const;                                  // Centred n x n Fresnel (exact = false) or angular spectrum kernel
+    PooledBuffer centredSpectrum(const std::vector<std::vector<std::complex<double>>> &A, int n) const; // FFT of a component padded to n x n, zero frequency at the centre
+    void applyTransferFunction(const PooledBuffer &H, int n);                                      // Filters both components with a centred kernel on an n x n grid
+    void propagateTransferFunction(double z, bool exact);                                                        // Fresnel (exact = false) or angular spectrum propagation
+    void propagateSingleFFT(double z);                                                                           // Single-FFT Fresnel transform, changes the pixel size
+    void accumulate(const WaveFront &other, double coefficient);                                                  // Adds coefficient * other, resampled onto this grid
+    void evaluate(const FieldSum &sum, bool add);                                                                 // Writes (or adds) a sum of fields in one pass
+    static void zoomPropagateGroup(const std::vector<const WaveFront *> &fields, double z, const std::vector<WaveFront *> &targets); // zoomPropagate of fields on one grid and wavelength, each onto its own target
+
 public:
-    std::vector<std::vector<std::complex<double>>> Ex; // Grid of Amplitudes
-    std::vector<std::vector<std::complex<double>>> Ey; // Grid of Polarizations
+    FieldGrid Ex;                                      // Grid of Amplitudes
+    FieldGrid Ey;                                      // Grid of Polarizations
     vec3 u, v, w;                                      // Local frame for the wavefront plane
     int N;                                             // The Ex and Ey will be a N x N grid
 
     WaveFront(ray normal, double wavelength, FieldType source, double psi, double delta, double w0, int l = 0, int p = 0, double size = 0.02, double pixel_size = 0.02 / 1024);
+    WaveFront(const FieldSum &sum); // Evaluates a sum of fields on the grid of its first term
+    WaveFront(const WaveFront &) = default;
+    WaveFront(WaveFront &&) noexcept = default;
+    WaveFront &operator=(const WaveFront &) = default;
+    WaveFront &operator=(WaveFront &&) noexcept = default;
 
     // Getters
     double getSize();
     double getPixelSize();
     double getWavelength();
     ray getNormal();
+    PropagationMethod getPropagationMethod() const { return method; }
+    double getGuardFactor() const { return guard; }
+
+    bool sameGrid(const WaveFront &other) const;    // Same size, pitch, position and orientation, so pixels correspond one to one
+    double fresnelNumber(double z) const;          // N * dx^2 / (lambda * z) for a propagation step z
+    PropagationMethod selectMethod(double z) const; // Method propagate() will use for a step z
 
     void get_LocalFrame();                              // Sets up orthogonal vectors for the local plane of the wavefront
     void propagate(double z);                           // Propagates the wavefront a distance z using FFTW
+    static void propagateBatch(std::vector<WaveFront> &batch, double z); // Propagates fields sharing a grid through one batched FFT plan
+    void zoomPropagate(double z, WaveFront &target) const; // Propagates a distance z straight onto target's (parallel) grid and adds the result to it
+    void propagateResampled(double z, double new_pixel_size, int new_N); // Propagates a distance z onto a new grid centred on the beam axis
+    static void propagateResampledBatch(std::vector<WaveFront> &batch, double z, double new_pixel_size, int new_N); // The same for every field, one zoom step per grid and wavelength
+    void predictExtent(double z, double &half_width, double &max_angle) const; // Half-width and largest angle of the beam after a step z, from its moments
+    bool chooseSampling(double half_width, double max_angle, int max_N, double &new_pixel_size, int &new_N) const; // Smallest grid (up to max_N) for that beam; false if the current one is adequate
+    BeamMoments moments() const;                                            // Second-moment statistics of position and angle
     void phaseShift(double phi);                        // Applies a constant phase shift to the wavefront
     void scale(double factor);                          // Scales the wavefront
     void reflect(vec3 n);                               // Reflects the wavefront
+    void rotatePlane(vec3 dir);                         // Re-expresses the field on the plane through the same centre with normal dir
     std::vector<std::vector<double>> Intensity() const; // returns an intensity map of the wavefront
     std::vector<std::vector<double>> Phase() const;     // returns a phase map of the wavefront
+    FieldStatistics sampleMaps(double *intensity, double *phase) const; // One pass writing row-major N x N intensity and phase maps (either may be null)
 
     void setPosition(vec3 pos);
     void setDirection(vec3 dir);
     void setSize(double s);
     void setPixelSize(double px);
+    void setGrid(double s, double px); // Sets size and pixel size together, reallocating the grids once
     void setWavelength(double w);
     void setFieldType(FieldType type);
     void setPsi(double theta);
     void setDelta(double theta);
     void setBeamWaist(double w);
     void setBeamMode(int L, int P);
+    void setPropagationMethod(PropagationMethod m) { method = m; }
+    void setGuardFactor(double g); // Pads convolution steps to N * g (>= 1) to suppress wraparound
     void initialize();      // Initializes the Electric Field Grids according to the FieldType
+    bool initializeIfChanged(); // Re-initializes only if a field parameter changed since the last initialize() (for fields not written in place, like sources); true if it did
+    void fieldAt(double x, double y, std::complex<double> &ex, std::complex<double> &ey) const; // Source field initialize() samples at (x, y) of the plane
 
-    WaveFront operator+(const WaveFront &other);
-    WaveFront operator-(const WaveFront &other);
-    WaveFront &operator+=(const WaveFront &other);
+    WaveFront &operator=(const FieldSum &sum);  // Evaluates a + b - ... in one pass; this takes the grid of the first term
+    WaveFront &operator+=(const FieldSum &sum);
+    WaveFront &operator+=(const WaveFront &other); // Adds other, resampled onto this grid if the geometries differ
     WaveFront &operator-=(const WaveFront &other);
+    WaveFront &operator+=(const FieldSlab &rows);  // Adds the part of a field held in rows, resampled onto this grid; the slabs of one field add up to +=
+};
+
+// Centred n x n Fresnel (exact = false) or band-limited angular spectrum kernel of a step z,
+// evaluated sample by sample so a distributed field can fill in just its own part
+class TransferFunction
+{
+private:
+    double z, wavelength, df, inv_lambda2, f_limit;
+    int n;
+    bool exact;
+    std::complex<double> carrier;
+
+public:
+    TransferFunction(double z, double wavelength, double pixel_size, int n, bool exact);
+    std::complex<double> operator()(int u, int v) const; // Row u and column v, zero frequency at n / 2
+};
+
+// Rows [first, first + count()) of an n x n field with the geometry element masks need, so a mask
+// runs alike on a whole grid and on the slab of a distributed one, which holds only its own rows
+struct FieldSlab
+{
+    int n = 0;      // Rows and columns of the whole grid
+    int centre = 0; // Row and column of the beam axis
+    int first = 0;  // First row held
+    double pixel_size = 0.0;
+    double wavelength = 0.0;
+    vec3 origin;                                // Where the beam axis crosses the grid's plane
+    vec3 u, v;                                  // Pixel (i, j) lies at origin + ((centre - i) u + (centre - j) v) * pixel_size
+    std::vector<std::complex<double> *> ex, ey; // Rows held: ex[r] is row first + r
+
+    FieldSlab() = default;
+    explicit FieldSlab(WaveFront &A); // Every row of A, whose grids it detaches
+    int count() const { return (int)ex.size(); }
+};
+
+// Lazy sum of wavefronts built by + and -, evaluated when assigned to a WaveFront. It refers to
+// its operands, so it must be consumed within the expression that creates it (not stored in auto)
+class FieldSum
+{
+public:
+    struct Term
+    {
+        const WaveFront *field;
+        double coefficient;
+    };
+
+    FieldSum(const WaveFront &a, double ca, const WaveFront &b, double cb) : terms{{&a, ca}, {&b, cb}} {}
+    FieldSum &add(const WaveFront &f, double c)
+    {
+        terms.push_back({&f, c});
+        return *this;
+    }
+    const std::vector<Term> &getTerms() const { return terms; }
+
+private:
+    std::vector<Term> terms;
 };
 
+inline FieldSum operator+(const WaveFront &a, const WaveFront &b) { return FieldSum(a, 1.0, b, 1.0); }
+inline FieldSum operator-(const WaveFront &a, const WaveFront &b) { return FieldSum(a, 1.0, b, -1.0); }
+inline FieldSum operator+(FieldSum sum, const WaveFront &b) { return std::move(sum.add(b, 1.0)); }
+inline FieldSum operator-(FieldSum sum, const WaveFront &b) { return std::move(sum.add(b, -1.0)); }
+inline WaveFront operator+(WaveFront &&a, const WaveFront &b) { return std::move(a += b); }
+inline WaveFront operator-(WaveFront &&a, const WaveFront &b) { return std::move(a -= b); }
+
 #endif
@@ -1,5 +1,7 @@
 #include "aperture.hpp"
 #include "utils.hpp"
+#include "gaussian_beam.hpp"
+#include "ray_bundle.hpp"
 #include <cmath>
 #include <iostream>
 
@@ -25,27 +27,66 @@ double Iris::hit(const ray &beamlet)
 
 void Iris::interact_ray(ray &beamlet) {}
 
+void Iris::hit_bundle(const RayBundle &rays, double *t)
+{
+    rays.intersectPlane(getPosition(), getOrientation(), t);
+    rays.clipDisc(getPosition(), size, t);
+}
+
+// Unlike the chief ray, which only finds the path, bundle rays outside the hole are blocked
+void Iris::interact_bundle(RayBundle &rays, const std::vector<int> &indices)
+{
+    const int n = (int)indices.size();
+    const vec3 c = getPosition();
+    const double cx = c.x(), cy = c.y(), cz = c.z();
+    const double r2 = radius * radius;
+
+#pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; k++)
+    {
+        int i = indices[k];
+        double hx = rays.px[i] - cx, hy = rays.py[i] - cy, hz = rays.pz[i] - cz;
+        if (hx * hx + hy * hy + hz * hz > r2)
+            rays.alive[i] = 0;
+    }
+}
+
 void Iris::interact_wavefront(WaveFront &A)
+{
+    FieldSlab slab(A);
+    interact_slab(slab);
+}
+
+bool Iris::interact_slab(FieldSlab &slab)
 {
     double r_sq = radius * radius;
-    vec3 displacement = A.getNormal().pos() - getPosition();
+    vec3 displacement = slab.origin - getPosition();
     double x_disp = dot(displacement, v);
     double y_disp = dot(displacement, u);
 
-    for (int i = 0; i < A.N; i++)
+    for (int i = 0; i < slab.count(); i++)
     {
-        double y = (A.N / 2 - i) * A.getPixelSize() + y_disp;
-        for (int j = 0; j < A.N; j++)
+        double y = (slab.centre - slab.first - i) * slab.pixel_size + y_disp;
+        for (int j = 0; j < slab.n; j++)
         {
-            double x = (A.N / 2 - j) * A.getPixelSize() + x_disp;
+            double x = (slab.centre - j) * slab.pixel_size + x_disp;
 
             if (x * x + y * y > r_sq)
             {
-                A.Ex[i][j] *= 0.0;
-                A.Ey[i][j] *= 0.0;
+                slab.ex[i][j] *= 0.0;
+                slab.ey[i][j] *= 0.0;
             }
         }
     }
+    return true;
+}
+
+bool Iris::interact_beam(GaussianBeam &beam)
+{
+    // An iris that does not clip the beam leaves it untouched
+    vec3 displacement = beam.getAxis().pos() - getPosition();
+    double offset = std::sqrt(sq(dot(displacement, u)) + sq(dot(displacement, v)));
+    return offset + beam.getExtent() <= radius;
 }
 
 Slit::Slit(vec3 position, vec3 orientation, std::string name, double size, double height, double width, int num_slits, double separation)
@@ -74,7 +115,48 @@ double Slit::hit(const ray &beamlet)
 
 void Slit::interact_ray(ray &beamlet) {}
 
+void Slit::hit_bundle(const RayBundle &rays, double *t)
+{
+    rays.intersectPlane(getPosition(), getOrientation(), t);
+    rays.clipDisc(getPosition(), size, t);
+}
+
+// Blocks the listed rays unless they pass through one of the slits (x along v, y along u, as in
+// interact_wavefront)
+void Slit::interact_bundle(RayBundle &rays, const std::vector<int> &indices)
+{
+    const int n = (int)indices.size();
+    const vec3 c = getPosition();
+    const double start_x = -(num_slits - 1) * separation / 2.0;
+
+#pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; k++)
+    {
+        int i = indices[k];
+        vec3 h(rays.px[i] - c.x(), rays.py[i] - c.y(), rays.pz[i] - c.z());
+        double x = dot(h, v), y = dot(h, u);
+
+        bool inside = false;
+        if (std::abs(y) <= height / 2.0)
+        {
+            // Nearest slit centre
+            int slit = num_slits > 1 ? (int)std::lround((x - start_x) / separation) : 0;
+            slit = min(max(slit, 0), num_slits - 1);
+            inside = std::abs(x - (start_x + slit * separation)) <= width / 2.0;
+        }
+        if (!inside)
+            rays.alive[i] = 0;
+    }
+}
+
 void Slit::interact_wavefront(WaveFront &A)
+{
+    FieldSlab slab(A);
+    interact_slab(slab);
+}
+
+// Columns of the slab are x (along the slits' separation), its rows y
+bool Slit::interact_slab(FieldSlab &slab)
 {
     std::vector<double> slit_centers;
     double start_x = -(num_slits - 1) * separation / 2.0;
@@ -82,16 +164,16 @@ void Slit::interact_wavefront(WaveFront &A)
         slit_centers.push_back(start_x + k * separation);
     }
 
-    vec3 displacement = A.getNormal().pos() - getPosition();
+    vec3 displacement = slab.origin - getPosition();
     double x_disp = dot(displacement, v);
     double y_disp = dot(displacement, u);
     
     double half_width = width / 2.0;
     double half_height = height / 2.0;
 
-    for (int i = 0; i < A.N; i++)
+    for (int i = 0; i < slab.n; i++)
     {
-        double x = (A.N / 2 - i) * A.getPixelSize() + x_disp;
+        double x = (slab.centre - i) * slab.pixel_size + x_disp;
         bool x_inside = false;
         for (double center_k : slit_centers) {
             if (std::abs(x - center_k) <= half_width) {
@@ -100,21 +182,22 @@ void Slit::interact_wavefront(WaveFront &A)
             }
         }
 
-        for (int j = 0; j < A.N; j++)
+        for (int j = 0; j < slab.count(); j++)
         {
             if (!x_inside) {
-                A.Ex[j][i] *= 0.0;
-                A.Ey[j][i] *= 0.0;
+                slab.ex[j][i] *= 0.0;
+                slab.ey[j][i] *= 0.0;
                 continue;
             }
 
-            double y = (A.N / 2 - j) * A.getPixelSize() + y_disp;
+            double y = (slab.centre - slab.first - j) * slab.pixel_size + y_disp;
             
             if (std::abs(y) > half_height)
             {
-                A.Ex[j][i] *= 0.0;
-                A.Ey[j][i] *= 0.0;
+                slab.ex[j][i] *= 0.0;
+                slab.ey[j][i] *= 0.0;
             }
         }
     }
+    return true;
 }
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "buffer_pool.hpp"
+#include <new>
+
+BufferPool::~BufferPool()
+{
+    trim();
+}
+
+BufferPool &BufferPool::instance()
+{
+    static BufferPool pool;
+    return pool;
+}
+
+size_t BufferPool::sizeClass(size_t count)
+{
+    const size_t page = 8192 / sizeof(fftw_complex);
+    return (count + page - 1) / page * page;
+}
+
+fftw_complex *BufferPool::acquire(size_t count)
+{
+    const size_t cls = sizeClass(count);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stats.bytesInUse += cls * sizeof(fftw_complex);
+        if (stats.bytesInUse > stats.peakBytesInUse)
+            stats.peakBytesInUse = stats.bytesInUse;
+
+        auto it = freeLists.find(cls);
+        if (it != freeLists.end() && !it->second.empty())
+        {
+            fftw_complex *block = it->second.back();
+            it->second.pop_back();
+            stats.bytesIdle -= cls * sizeof(fftw_complex);
+            stats.reuses++;
+            return block;
+        }
+        stats.heapAllocations++;
+    }
+
+    fftw_complex *block = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * cls);
+    if (!block)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stats.bytesInUse -= cls * sizeof(fftw_complex);
+        stats.heapAllocations--;
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+void BufferPool::release(fftw_complex *block, size_t count)
+{
+    if (!block)
+        return;
+
+    const size_t cls = sizeClass(count);
+    const size_t bytes = cls * sizeof(fftw_complex);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stats.bytesInUse -= bytes;
+        if (stats.bytesIdle + bytes <= idleLimit)
+        {
+            freeLists[cls].push_back(block);
+            stats.bytesIdle += bytes;
+            return;
+        }
+    }
+    fftw_free(block);
+}
+
+void BufferPool::trim()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto &entry : freeLists)
+        for (fftw_complex *block : entry.second)
+            fftw_free(block);
+    freeLists.clear();
+    stats.bytesIdle = 0;
+}
+
+void BufferPool::setIdleLimit(size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    idleLimit = bytes;
+    // Largest blocks first: they are the likeliest to be left over from a bigger grid than the next run's
+    for (auto it = freeLists.rbegin(); it != freeLists.rend() && stats.bytesIdle > idleLimit; ++it)
+        while (!it->second.empty() && stats.bytesIdle > idleLimit)
+        {
+            fftw_free(it->second.back());
+            it->second.pop_back();
+            stats.bytesIdle -= it->first * sizeof(fftw_complex);
+        }
+}
+
+BufferPoolStats BufferPool::getStats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
+
+PooledBuffer::PooledBuffer(size_t count)
+    : block(BufferPool::instance().acquire(count)), count(count) {}
+
+PooledBuffer::~PooledBuffer()
+{
+    BufferPool::instance().release(block, count);
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer &&other) noexcept
+    : block(other.block), count(other.count)
+{
+    other.block = nullptr;
+    other.count = 0;
+}
+
+PooledBuffer &PooledBuffer::operator=(PooledBuffer &&other) noexcept
+{
+    if (this != &other)
+    {
+        BufferPool::instance().release(block, count);
+        block = other.block;
+        count = other.count;
+        other.block = nullptr;
+        other.count = 0;
+    }
+    return *this;
+}
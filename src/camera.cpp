@@ -1,6 +1,10 @@
 #include "camera.hpp"
+#include "gaussian_beam.hpp"
+#include "ray_bundle.hpp"
 
-Camera::Camera(const vec3 &position, const vec3 &orientation, std::string name, double size) : OpticalElement(position, orientation, name), size(size), sensedWavefront(ray(position, orientation), 633e-9, FieldType::BLANK, 0.0, 0.0, 1e-3, 0, 0, size, size / 1024.0)
+Camera::Camera(const vec3 &position, const vec3 &orientation, std::string name, double size, int resolution)
+    : OpticalElement(position, orientation, name), size(size), resolution(resolution), roiSize(size), roiX(0.0), roiY(0.0),
+      sensedWavefront(ray(position, orientation), 633e-9, FieldType::BLANK, 0.0, 0.0, 1e-3, 0, 0, size, size / resolution)
 {
     sensedWavefront.initialize();
 }
@@ -29,12 +33,106 @@ void Camera::interact_ray(ray &beamlet)
     beamlet.kill();
 }
 
+void Camera::hit_bundle(const RayBundle &rays, double *t)
+{
+    rays.intersectPlane(getPosition(), getOrientation(), t);
+    rays.clipSquare(getPosition(), v, u, size / 2.0, t);
+}
+
+// Records where the listed rays landed for the spot diagram and absorbs them
+void Camera::interact_bundle(RayBundle &rays, const std::vector<int> &indices)
+{
+    const int n = (int)indices.size();
+    const size_t first = spotX.size();
+    spotX.resize(first + n);
+    spotY.resize(first + n);
+
+    const vec3 c = getPosition();
+    const double cx = c.x(), cy = c.y(), cz = c.z();
+    const double vx = v.x(), vy = v.y(), vz = v.z();
+    const double ux = u.x(), uy = u.y(), uz = u.z();
+
+#pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; k++)
+    {
+        int i = indices[k];
+        double hx = rays.px[i] - cx, hy = rays.py[i] - cy, hz = rays.pz[i] - cz;
+        spotX[first + k] = hx * vx + hy * vy + hz * vz;
+        spotY[first + k] = hx * ux + hy * uy + hz * uz;
+        rays.alive[i] = 0;
+    }
+}
+
+void Camera::clearSpots()
+{
+    spotX.clear();
+    spotY.clear();
+}
+
 void Camera::interact_wavefront(WaveFront &A)
 {
     sensedWavefront += A;
     A.scale(0.0);
 }
 
+void Camera::receive_wavefront(WaveFront &A, double distance)
+{
+    // A tilted sensor gets the field rotated onto its plane (facing the beam) in the frequency domain
+    vec3 sensor_dir = sensedWavefront.getNormal().dir();
+    double alignment = dot(A.getNormal().dir(), sensor_dir);
+    if (std::abs(alignment) < 1.0 - 1e-9)
+    {
+        A.propagate(distance);
+        A.rotatePlane(alignment > 0.0 ? sensor_dir : -sensor_dir);
+        interact_wavefront(A);
+        return;
+    }
+
+    // Zoom propagation needs the field and sensor planes to be parallel with aligned axes
+    if (!zoomPropagation || alignment < 0.0)
+    {
+        OpticalElement::receive_wavefront(A, distance);
+        return;
+    }
+
+    A.zoomPropagate(distance, sensedWavefront);
+    A.scale(0.0);
+}
+
+bool Camera::window(const FieldSlab &field, int &i0, int &i1, int &j0, int &j1)
+{
+    // Grid indices of the sensor's corners: the map between the planes is affine, so they bound
+    // the pixels the resampling reads (plus one for the bilinear neighbours)
+    const int N = sensedWavefront.N;
+    const double pitch = sensedWavefront.getPixelSize();
+    double iLow = INF, iHigh = -INF, jLow = INF, jHigh = -INF;
+    for (int corner = 0; corner < 4; corner++)
+    {
+        double a = (corner & 1) ? N - 1 : 0, b = (corner & 2) ? N - 1 : 0;
+        vec3 p = sensedWavefront.getNormal().pos() + (N / 2.0 - a) * pitch * sensedWavefront.u + (N / 2.0 - b) * pitch * sensedWavefront.v;
+        double i = field.centre - dot(p - field.origin, field.u) / field.pixel_size;
+        double j = field.centre - dot(p - field.origin, field.v) / field.pixel_size;
+        iLow = min(iLow, i);
+        iHigh = max(iHigh, i);
+        jLow = min(jLow, j);
+        jHigh = max(jHigh, j);
+    }
+    i0 = (int)max(0.0, std::floor(iLow) - 1.0);
+    i1 = (int)min(field.n - 1.0, std::ceil(iHigh) + 1.0);
+    j0 = (int)max(0.0, std::floor(jLow) - 1.0);
+    j1 = (int)min(field.n - 1.0, std::ceil(jHigh) + 1.0);
+    return i0 <= i1 && j0 <= j1;
+}
+
+bool Camera::interact_beam(GaussianBeam &beam)
+{
+    if (dot(beam.getAxis().dir(), sensedWavefront.getNormal().dir()) < 1.0 - 1e-9)
+        return false;
+
+    beam.rasterize(sensedWavefront);
+    return true;
+}
+
 WaveFront &Camera::getSensedWaveFront()
 {
     return  sensedWavefront;
@@ -42,23 +140,103 @@ WaveFront &Camera::getSensedWaveFront()
 
 void Camera::reset()
 {
+    rebuildSensor(); // Also restores the full resolution after a preview stored a coarser field
+    exposureX.clear();
+    exposureY.clear();
+    phaseX.clear();
+    phaseY.clear();
+}
+
+void Camera::expose(double weight)
+{
+    const int N = sensedWavefront.N;
+    const FieldGrid::Rows &ex = sensedWavefront.Ex.read(), &ey = sensedWavefront.Ey.read();
+    if (exposureX.size() != (size_t)N * N)
+    {
+        exposureX.assign((size_t)N * N, 0.0);
+        exposureY.assign((size_t)N * N, 0.0);
+
+        // The phase of the first exposure survives develop(), so coherent sources keep theirs
+        auto phasor = [](std::complex<double> a) { return std::abs(a) > 0.0 ? a / std::abs(a) : std::complex<double>(1.0); };
+        phaseX.resize((size_t)N * N);
+        phaseY.resize((size_t)N * N);
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < N; i++)
+            for (int j = 0; j < N; j++)
+            {
+                phaseX[i * N + j] = phasor(ex[i][j]);
+                phaseY[i * N + j] = phasor(ey[i][j]);
+            }
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++)
+        {
+            exposureX[i * N + j] += weight * std::norm(ex[i][j]);
+            exposureY[i * N + j] += weight * std::norm(ey[i][j]);
+        }
+
+    sensedWavefront.scale(0.0);
+}
+
+void Camera::develop()
+{
+    const int N = sensedWavefront.N;
+    if (exposureX.size() != (size_t)N * N)
+        return;
+
+    FieldGrid::Rows &ex = sensedWavefront.Ex.replace(), &ey = sensedWavefront.Ey.replace();
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++)
+        {
+            ex[i][j] = std::sqrt(exposureX[i * N + j]) * phaseX[i * N + j];
+            ey[i][j] = std::sqrt(exposureY[i * N + j]) * phaseY[i * N + j];
+        }
+
+    exposureX.clear();
+    exposureY.clear();
+    phaseX.clear();
+    phaseY.clear();
+}
+
+void Camera::rebuildSensor()
+{
+    vec3 centre = getPosition() + roiX * v + roiY * u;
+    sensedWavefront = WaveFront(ray(centre, getOrientation()), 633e-9, FieldType::BLANK, 0.0, 0.0, 1e-3, 0, 0, roiSize, roiSize / resolution);
     sensedWavefront.initialize();
 }
 
 void Camera::setPosition(vec3 pos)
 {
     OpticalElement::setPosition(pos);
-    sensedWavefront.setPosition(pos);
+    sensedWavefront.setPosition(pos + roiX * v + roiY * u);
 }
 
 void Camera::setOrientation(vec3 o)
 {
     OpticalElement::setOrientation(o);
-    sensedWavefront.setDirection(o);
+    sensedWavefront.setDirection(getOrientation());
+    sensedWavefront.setPosition(getPosition() + roiX * v + roiY * u);
 }
 
 void Camera::setSize(double s)
 {
     size = s;
-    sensedWavefront.setSize(s);
-}
\ No newline at end of file
+    setROI(s);
+}
+
+void Camera::setResolution(int pixels)
+{
+    resolution = max(1, pixels);
+    rebuildSensor();
+}
+
+void Camera::setROI(double width, double x, double y)
+{
+    roiSize = min(width, size);
+    roiX = x;
+    roiY = y;
+    rebuildSensor();
+}
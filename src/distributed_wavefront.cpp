@@ -0,0 +1,257 @@
+#include "distributed_wavefront.hpp"
+
+#ifdef OSL_MPI
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include "simulation_engine.hpp"
+#include "utils.hpp"
+
+DistributedWaveFront::DistributedWaveFront(WaveFront &shape, int samples, MPI_Comm comm)
+    : comm(comm), normal(shape.getNormal()), u(shape.u), v(shape.v), w(shape.w)
+{
+    MPI_Comm_rank(comm, &rank);
+    wavelength = shape.getWavelength();
+    N = nextFastFFTSize(samples > 0 ? samples : shape.N);
+    pixel_size = shape.getSize() / N;
+    n = nextFastFFTSize((int)std::ceil(N * shape.getGuardFactor()));
+
+    ptrdiff_t count = fftw_mpi_local_size_2d_transposed(n, n, comm, &rows, &firstRow, &columns, &firstColumn);
+    count = max(count, (ptrdiff_t)1); // A rank without rows still passes a valid buffer
+    Ex = PooledBuffer(count);
+    Ey = PooledBuffer(count);
+
+    forward = fftw_mpi_plan_dft_2d(n, n, Ex.fftw(), Ex.fftw(), comm, FFTW_FORWARD, FFTW_ESTIMATE | FFTW_MPI_TRANSPOSED_OUT);
+    inverse = fftw_mpi_plan_dft_2d(n, n, Ex.fftw(), Ex.fftw(), comm, FFTW_BACKWARD, FFTW_ESTIMATE | FFTW_MPI_TRANSPOSED_IN);
+    clear();
+}
+
+DistributedWaveFront::~DistributedWaveFront()
+{
+    fftw_destroy_plan(forward);
+    fftw_destroy_plan(inverse);
+}
+
+void DistributedWaveFront::clear()
+{
+    std::fill(Ex.data(), Ex.data() + Ex.size(), 0.0);
+    std::fill(Ey.data(), Ey.data() + Ey.size(), 0.0);
+}
+
+void DistributedWaveFront::initialize(const WaveFront &shape)
+{
+    const int pad = (n - N) / 2;
+    std::complex<double> *ex = Ex.data(), *ey = Ey.data();
+    clear();
+
+#pragma omp parallel for schedule(static)
+    for (ptrdiff_t r = 0; r < rows; r++)
+    {
+        int i = (int)(firstRow + r) - pad; // Row of the field
+        if (i < 0 || i >= N)
+            continue;
+        double y = (i - N / 2) * pixel_size;
+        for (int j = 0; j < N; j++)
+            shape.fieldAt((j - N / 2) * pixel_size, y, ex[r * n + pad + j], ey[r * n + pad + j]);
+    }
+}
+
+void DistributedWaveFront::propagate(double z, bool exact)
+{
+    if (z == 0.0)
+        return;
+
+    const int pad = (n - N) / 2;
+    const double norm = 1.0 / (double(n) * n);
+    std::complex<double> *ex = Ex.data(), *ey = Ey.data();
+
+    // The (-1)^(i+j) factors move the zero frequency to the grid centre, as embedCentred does
+#pragma omp parallel for schedule(static)
+    for (ptrdiff_t r = 0; r < rows; r++)
+        for (int j = 0; j < n; j++)
+            if ((firstRow + r + j) & 1)
+            {
+                ex[r * n + j] = -ex[r * n + j];
+                ey[r * n + j] = -ey[r * n + j];
+            }
+
+    fftw_mpi_execute_dft(forward, Ex.fftw(), Ex.fftw());
+    fftw_mpi_execute_dft(forward, Ey.fftw(), Ey.fftw());
+
+    // Row r of the transposed spectrum is column firstColumn + r of the centred one
+    TransferFunction H(z, wavelength, pixel_size, n, exact);
+#pragma omp parallel for schedule(static)
+    for (ptrdiff_t r = 0; r < columns; r++)
+        for (int c = 0; c < n; c++)
+        {
+            std::complex<double> h = H(c, (int)(firstColumn + r));
+            ex[r * n + c] *= h;
+            ey[r * n + c] *= h;
+        }
+
+    fftw_mpi_execute_dft(inverse, Ex.fftw(), Ex.fftw());
+    fftw_mpi_execute_dft(inverse, Ey.fftw(), Ey.fftw());
+
+    // Undoes the centring and crops to the field, like extractCentred followed by the next embedCentred
+#pragma omp parallel for schedule(static)
+    for (ptrdiff_t r = 0; r < rows; r++)
+    {
+        const ptrdiff_t i = firstRow + r;
+        const bool inside = i >= pad && i < pad + N;
+        for (int j = 0; j < n; j++)
+        {
+            double s = !inside || j < pad || j >= pad + N ? 0.0 : ((i + j) & 1) ? -norm : norm;
+            ex[r * n + j] *= s;
+            ey[r * n + j] *= s;
+        }
+    }
+
+    normal.propagate(z);
+}
+
+FieldSlab DistributedWaveFront::slab()
+{
+    FieldSlab slab;
+    slab.n = n;
+    slab.centre = n / 2; // The field's own centre, N / 2 + pad
+    slab.first = (int)firstRow;
+    slab.pixel_size = pixel_size;
+    slab.wavelength = wavelength;
+    slab.origin = normal.pos();
+    slab.u = u;
+    slab.v = v;
+    for (ptrdiff_t r = 0; r < rows; r++)
+    {
+        slab.ex.push_back(Ex.data() + r * n);
+        slab.ey.push_back(Ey.data() + r * n);
+    }
+    return slab;
+}
+
+bool DistributedWaveFront::interact(OpticalElement &element)
+{
+    FieldSlab rows = slab();
+    return element.interact_slab(rows);
+}
+
+bool DistributedWaveFront::receive(Camera &camera)
+{
+    if (std::abs(dot(camera.getSensedWaveFront().w, w)) < 1.0 - 1e-9)
+        return false; // Needs the rotation of the whole angular spectrum
+
+    const FieldSlab field = slab();
+    int i0, i1, j0, j1;
+    if (!camera.window(field, i0, i1, j0, j1))
+    {
+        clear(); // The sensor is off the grid, and it still absorbs the beam
+        return true;
+    }
+
+    // Every rank sends the window's rows it holds: Ex, then Ey
+    const int width = j1 - j0 + 1;
+    const ptrdiff_t low = max((ptrdiff_t)i0, firstRow), high = min((ptrdiff_t)i1 + 1, firstRow + rows);
+    const int held = high > low ? (int)(high - low) : 0;
+    std::vector<std::complex<double>> block(2 * (size_t)held * width);
+    for (int r = 0; r < held; r++)
+    {
+        const size_t row = (size_t)(low + r - firstRow) * n + j0;
+        std::copy(Ex.data() + row, Ex.data() + row + width, block.begin() + (size_t)r * width);
+        std::copy(Ey.data() + row, Ey.data() + row + width, block.begin() + (size_t)(held + r) * width);
+    }
+    clear(); // The sensor absorbs the field
+
+    int ranks;
+    MPI_Comm_size(comm, &ranks);
+    std::vector<int> counts(ranks), offsets(ranks, 0);
+    int sent = (int)block.size();
+    MPI_Gather(&sent, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, comm);
+    std::vector<std::complex<double>> window;
+    if (rank == 0)
+    {
+        for (int k = 1; k < ranks; k++)
+            offsets[k] = offsets[k - 1] + counts[k - 1];
+        window.resize((size_t)offsets[ranks - 1] + counts[ranks - 1]);
+    }
+    MPI_Gatherv(block.data(), sent, MPI_C_DOUBLE_COMPLEX, window.data(), counts.data(), offsets.data(), MPI_C_DOUBLE_COMPLEX, 0, comm);
+    if (rank != 0)
+        return true;
+
+    // Slabs arrive in row order, each as its Ex rows followed by its Ey rows. The window is
+    // resampled onto the sensor where it landed: as a slab of its own whose reference point is
+    // pixel (i0, j0), so its rows and columns count from 0
+    FieldSlab part;
+    part.n = width;
+    part.centre = 0;
+    part.pixel_size = field.pixel_size;
+    part.wavelength = field.wavelength;
+    part.origin = field.origin + ((field.centre - i0) * field.u + (field.centre - j0) * field.v) * field.pixel_size;
+    part.u = field.u;
+    part.v = field.v;
+    for (int k = 0; k < ranks; k++)
+    {
+        const int slabRows = counts[k] / 2 / width;
+        std::complex<double> *ex = window.data() + offsets[k], *ey = ex + (size_t)slabRows * width;
+        for (int r = 0; r < slabRows; r++)
+        {
+            part.ex.push_back(ex + (size_t)r * width);
+            part.ey.push_back(ey + (size_t)r * width);
+        }
+    }
+    camera.receiveSlab(part);
+    return true;
+}
+
+bool DistributedSimulation::Run(Scene &scene, const SimulationSettings &settings, int N, MPI_Comm comm, std::string &error)
+{
+    // std::set orders the paths by address, which differs from rank to rank: every rank has to
+    // run them in the same order, so they are sorted by the scene order of their objects
+    std::map<const void *, int> order;
+    for (auto &obj : scene.GetObjects())
+        order[obj->source ? (const void *)obj->source.get() : (const void *)obj->element.get()] = (int)order.size();
+
+    std::set<SimulationEngine::Path> found = SimulationEngine::FindPaths(scene);
+    std::vector<std::pair<std::vector<int>, const SimulationEngine::Path *>> paths;
+    for (auto &path : found)
+    {
+        if (!SimulationEngine::CheckFixedGrid(settings, path, "distributed", error))
+            return false;
+        std::vector<int> key = {order[path.source]};
+        for (auto element : path.Elements)
+            key.push_back(order[element]);
+        paths.emplace_back(key, &path);
+    }
+    std::sort(paths.begin(), paths.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+
+    for (auto &entry : paths)
+    {
+        const SimulationEngine::Path &path = *entry.second;
+        WaveFront &shape = path.source->E;
+        const bool exact = shape.getPropagationMethod() != PropagationMethod::FRESNEL;
+
+        DistributedWaveFront field(shape, N, comm);
+        field.initialize(shape);
+        for (auto element : path.Elements)
+        {
+            double dist = element->hit(field.getNormal());
+            if (dist == -999.0)
+                continue;
+
+            if (!SimulationEngine::CheckFixedGridStep(path, *element, dist, field.fresnelNumber(dist), "distributed", error))
+                return false;
+
+            field.propagate(dist, exact);
+            Camera *camera = dynamic_cast<Camera *>(element);
+            if (camera ? !field.receive(*camera) : !field.interact(*element))
+            {
+                error = element->getName() + (camera ? " is tilted against the beam" : " needs the whole field") + ", which distributed runs do not support";
+                return false;
+            }
+            if (camera)
+                break; // The sensor absorbs the beam
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,222 @@
+#include "element_bvh.hpp"
+#include <algorithm>
+#include <cmath>
+
+void ElementBVH::update(const std::vector<OpticalElement *> &list)
+{
+    const double pad = 1e-9; // Flat elements have zero-width boxes along their normal
+
+    if (list != elements)
+    {
+        elements = list;
+        boxLo.resize(elements.size());
+        boxHi.resize(elements.size());
+        for (size_t k = 0; k < elements.size(); k++)
+        {
+            elements[k]->getBounds(boxLo[k], boxHi[k]);
+            boxLo[k] -= vec3(pad, pad, pad);
+            boxHi[k] += vec3(pad, pad, pad);
+        }
+        build();
+        return;
+    }
+
+    for (size_t k = 0; k < elements.size(); k++)
+    {
+        vec3 lo, hi;
+        elements[k]->getBounds(lo, hi);
+        lo -= vec3(pad, pad, pad);
+        hi += vec3(pad, pad, pad);
+        if ((lo - boxLo[k]).length_squared() == 0.0 && (hi - boxHi[k]).length_squared() == 0.0)
+            continue;
+        boxLo[k] = lo;
+        boxHi[k] = hi;
+        refit(leafOf[k]);
+    }
+}
+
+void ElementBVH::build()
+{
+    const int n = (int)elements.size();
+    order.resize(n);
+    for (int k = 0; k < n; k++)
+        order[k] = k;
+    leafOf.assign(n, -1);
+
+    nodes.clear();
+    parent.clear();
+    if (n == 0)
+        return;
+    nodes.reserve(2 * n);
+    parent.reserve(2 * n);
+    nodes.emplace_back();
+    parent.push_back(-1);
+    buildNode(0, 0, n);
+}
+
+// Median split of the element centres along the box's longest axis
+int ElementBVH::buildNode(int index, int first, int count)
+{
+    vec3 lo = boxLo[order[first]], hi = boxHi[order[first]];
+    vec3 clo = 0.5 * (lo + hi), chi = clo;
+    for (int k = first; k < first + count; k++)
+    {
+        int e = order[k];
+        vec3 centre = 0.5 * (boxLo[e] + boxHi[e]);
+        for (int a = 0; a < 3; a++)
+        {
+            lo[a] = min(lo[a], boxLo[e][a]);
+            hi[a] = max(hi[a], boxHi[e][a]);
+            clo[a] = min(clo[a], centre[a]);
+            chi[a] = max(chi[a], centre[a]);
+        }
+    }
+    nodes[index].lo = lo;
+    nodes[index].hi = hi;
+
+    if (count <= LEAF_SIZE)
+    {
+        nodes[index].first = first;
+        nodes[index].count = count;
+        for (int k = first; k < first + count; k++)
+            leafOf[order[k]] = index;
+        return index;
+    }
+
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (chi[a] - clo[a] > chi[axis] - clo[axis])
+            axis = a;
+
+    const int half = count / 2;
+    std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+                     [&](int a, int b) { return boxLo[a][axis] + boxHi[a][axis] < boxLo[b][axis] + boxHi[b][axis]; });
+
+    const int left = (int)nodes.size();
+    nodes.resize(left + 2);
+    parent.resize(left + 2, index);
+    nodes[index].left = left;
+    buildNode(left, first, half);
+    buildNode(left + 1, first + half, count - half);
+    return index;
+}
+
+// Recomputes the bounds of a node and of every node above it
+void ElementBVH::refit(int node)
+{
+    while (node != -1)
+    {
+        Node &n = nodes[node];
+        if (n.left < 0)
+        {
+            n.lo = boxLo[order[n.first]];
+            n.hi = boxHi[order[n.first]];
+            for (int k = n.first + 1; k < n.first + n.count; k++)
+                for (int a = 0; a < 3; a++)
+                {
+                    n.lo[a] = min(n.lo[a], boxLo[order[k]][a]);
+                    n.hi[a] = max(n.hi[a], boxHi[order[k]][a]);
+                }
+        }
+        else
+        {
+            const Node &l = nodes[n.left], &r = nodes[n.left + 1];
+            for (int a = 0; a < 3; a++)
+            {
+                n.lo[a] = min(l.lo[a], r.lo[a]);
+                n.hi[a] = max(l.hi[a], r.hi[a]);
+            }
+        }
+        node = parent[node];
+    }
+}
+
+double ElementBVH::slab(const Node &node, const point3 &p, const vec3 &inv, double limit)
+{
+    double t0 = 0.0, t1 = limit;
+    for (int a = 0; a < 3; a++)
+    {
+        double ta = (node.lo[a] - p[a]) * inv[a], tb = (node.hi[a] - p[a]) * inv[a];
+        if (ta > tb)
+            std::swap(ta, tb);
+        if (ta > t0)
+            t0 = ta;
+        if (tb < t1)
+            t1 = tb;
+        if (t0 > t1) // A NaN bound (zero direction component on a box face) leaves the interval as is
+            return -1.0;
+    }
+    return t0;
+}
+
+int ElementBVH::closestHit(const ray &beamlet, double &dist, int skip, const std::vector<char> *excluded) const
+{
+    int best = -1;
+    double best_dist = INF;
+    if (nodes.empty())
+        return best;
+
+    // Children are visited nearest box first, so the first hits found shrink best_dist and
+    // prune the far side of the tree
+    const point3 p = beamlet.pos();
+    const vec3 d = beamlet.dir();
+    const vec3 inv(1.0 / d.x(), 1.0 / d.y(), 1.0 / d.z());
+
+    struct Entry
+    {
+        int node;
+        double t;
+    } stack[64];
+    int top = 0;
+    double t_root = slab(nodes[0], p, inv, best_dist);
+    if (t_root < 0.0)
+        return best;
+    stack[top++] = {0, t_root};
+    while (top > 0)
+    {
+        const Entry entry = stack[--top];
+        if (entry.t > best_dist)
+            continue;
+        const Node &node = nodes[entry.node];
+
+        if (node.left >= 0)
+        {
+            double tl = slab(nodes[node.left], p, inv, best_dist);
+            double tr = slab(nodes[node.left + 1], p, inv, best_dist);
+            if (tl >= 0.0 && tr >= 0.0)
+            {
+                if (tl <= tr)
+                {
+                    stack[top++] = {node.left + 1, tr};
+                    stack[top++] = {node.left, tl};
+                }
+                else
+                {
+                    stack[top++] = {node.left, tl};
+                    stack[top++] = {node.left + 1, tr};
+                }
+            }
+            else if (tl >= 0.0)
+                stack[top++] = {node.left, tl};
+            else if (tr >= 0.0)
+                stack[top++] = {node.left + 1, tr};
+            continue;
+        }
+
+        for (int k = node.first; k < node.first + node.count; k++)
+        {
+            int e = order[k];
+            if (e == skip || (excluded && (*excluded)[e]))
+                continue;
+            double d = elements[e]->hit(beamlet);
+            if (d != -999.0 && d <= best_dist)
+            {
+                best_dist = d;
+                best = e;
+            }
+        }
+    }
+
+    dist = best_dist;
+    return best;
+}
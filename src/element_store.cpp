@@ -0,0 +1,141 @@
+#include "element_store.hpp"
+#include <cmath>
+#include <vector>
+
+// Records the concrete type once, so nothing downstream needs dynamic_cast or virtual calls
+template <typename T>
+static bool capture(OpticalElement *element, ElementStore::Concrete &out)
+{
+    if (T *typed = dynamic_cast<T *>(element))
+    {
+        out = typed;
+        return true;
+    }
+    return false;
+}
+
+void ElementStore::build(const std::vector<OpticalElement *> &list)
+{
+    records.clear();
+    records.reserve(list.size());
+
+    for (auto element : list)
+    {
+        Record rec;
+        rec.centre = element->getPosition();
+        rec.normal = element->getOrientation();
+        rec.a = element->v;
+        rec.b = element->u;
+
+        if (capture<ConvexLens>(element, rec.element) || capture<ConcaveLens>(element, rec.element) ||
+            capture<Iris>(element, rec.element) || capture<Slit>(element, rec.element))
+        {
+            rec.reach = element->apertureRadius();
+            rec.square = false;
+        }
+        else if (capture<Mirror>(element, rec.element))
+        {
+            rec.reach = std::get<Mirror *>(rec.element)->getSize() / 2.0;
+            rec.square = true;
+        }
+        else if (capture<Camera>(element, rec.element))
+        {
+            rec.reach = std::get<Camera *>(rec.element)->getSize() / 2.0;
+            rec.square = true;
+        }
+        else
+        {
+            rec.element = element; // Traced by its own virtual hit_bundle()
+            rec.reach = element->apertureRadius();
+            rec.square = false;
+        }
+
+        records.push_back(rec);
+    }
+}
+
+// Nearest-hit update of every ray against one record; the aperture shape is a template
+// parameter so the loop body has no branch left on it and vectorizes
+template <bool Square>
+static void sweep(const ElementStore::Record &rec, int e, const RayBundle &rays, const int *last, int *target, double *dist)
+{
+    const int n = (int)rays.size();
+    const double *px = rays.px.data(), *py = rays.py.data(), *pz = rays.pz.data();
+    const double *dx = rays.dx.data(), *dy = rays.dy.data(), *dz = rays.dz.data();
+    const double nx = rec.normal.x(), ny = rec.normal.y(), nz = rec.normal.z();
+    const double cx = rec.centre.x(), cy = rec.centre.y(), cz = rec.centre.z();
+    const double ax = rec.a.x(), ay = rec.a.y(), az = rec.a.z();
+    const double bx = rec.b.x(), by = rec.b.y(), bz = rec.b.z();
+    const double offset = cx * nx + cy * ny + cz * nz;
+    const double reach = rec.reach, r2 = reach * reach;
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++)
+    {
+        double denom = dx[i] * nx + dy[i] * ny + dz[i] * nz;
+        double t = (offset - (px[i] * nx + py[i] * ny + pz[i] * nz)) / denom;
+        double hx = px[i] + dx[i] * t - cx, hy = py[i] + dy[i] * t - cy, hz = pz[i] + dz[i] * t - cz;
+        bool inside;
+        if (Square)
+        {
+            double x = hx * ax + hy * ay + hz * az, y = hx * bx + hy * by + hz * bz;
+            inside = (std::abs(x) <= reach) & (std::abs(y) <= reach);
+        }
+        else
+            inside = hx * hx + hy * hy + hz * hz <= r2;
+
+        // Dead rays start at dist -1.0, which no hit beats
+        bool closer = inside & (std::abs(denom) >= 1e-6) & (t >= 1e-6) & (e != last[i]) & (t <= dist[i]);
+        dist[i] = closer ? t : dist[i];
+        target[i] = closer ? e : target[i];
+    }
+}
+
+void ElementStore::closestHits(const RayBundle &rays, const int *last, int *target, double *dist) const
+{
+    const int n = (int)rays.size();
+    for (int i = 0; i < n; i++)
+    {
+        target[i] = -1;
+        dist[i] = rays.alive[i] ? INF : -1.0;
+    }
+
+    std::vector<double> t;
+    for (int e = 0; e < (int)records.size(); e++)
+    {
+        if (OpticalElement *const *generic = std::get_if<OpticalElement *>(&records[e].element))
+        {
+            t.resize(n);
+            (*generic)->hit_bundle(rays, t.data());
+            for (int i = 0; i < n; i++)
+            {
+                bool closer = t[i] != -999.0 && t[i] >= 1e-6 && e != last[i] && t[i] <= dist[i];
+                dist[i] = closer ? t[i] : dist[i];
+                target[i] = closer ? e : target[i];
+            }
+        }
+        else if (records[e].square)
+            sweep<true>(records[e], e, rays, last, target, dist);
+        else
+            sweep<false>(records[e], e, rays, last, target, dist);
+    }
+}
+
+void ElementStore::interact(int index, RayBundle &rays, const std::vector<int> &indices) const
+{
+    // Qualified calls bind to the concrete override at compile time
+    struct Dispatch
+    {
+        RayBundle &rays;
+        const std::vector<int> &indices;
+
+        void operator()(ConvexLens *e) const { e->ConvexLens::interact_bundle(rays, indices); }
+        void operator()(ConcaveLens *e) const { e->ConcaveLens::interact_bundle(rays, indices); }
+        void operator()(Mirror *e) const { e->Mirror::interact_bundle(rays, indices); }
+        void operator()(Iris *e) const { e->Iris::interact_bundle(rays, indices); }
+        void operator()(Slit *e) const { e->Slit::interact_bundle(rays, indices); }
+        void operator()(Camera *e) const { e->Camera::interact_bundle(rays, indices); }
+        void operator()(OpticalElement *e) const { e->interact_bundle(rays, indices); }
+    };
+    std::visit(Dispatch{rays, indices}, records[index].element);
+}
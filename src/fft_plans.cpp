@@ -0,0 +1,48 @@
+#include "fft_plans.hpp"
+#include "buffer_pool.hpp"
+
+FftPlans::~FftPlans()
+{
+    clear();
+}
+
+FftPlans &FftPlans::instance()
+{
+    static FftPlans cache;
+    return cache;
+}
+
+fftw_plan FftPlans::get(int rank, int n, int howmany, int stride, int dist, int direction, bool inPlace)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    const Key key(rank, n, howmany, stride, dist, direction, inPlace);
+    auto it = plans.find(key);
+    if (it != plans.end())
+        return it->second;
+
+    // FFTW_MEASURE overwrites the arrays it plans on, so these are scratch
+    const int dims[2] = {n, n};
+    const size_t points = (size_t)n * (rank == 2 ? n : 1);
+    const size_t count = (size_t)(howmany - 1) * dist + (points - 1) * stride + 1;
+    PooledBuffer in(count), out;
+    if (!inPlace)
+        out = PooledBuffer(count);
+    fftw_complex *target = inPlace ? in.fftw() : out.fftw();
+    fftw_plan plan = fftw_plan_many_dft(rank, dims, howmany, in.fftw(), nullptr, stride, dist, target, nullptr, stride, dist, direction, flags);
+    plans.emplace(key, plan);
+    return plan;
+}
+
+void FftPlans::setPatient(bool patient)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    flags = patient ? FFTW_MEASURE : FFTW_ESTIMATE;
+}
+
+void FftPlans::clear()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto &entry : plans)
+        fftw_destroy_plan(entry.second);
+    plans.clear();
+}
@@ -0,0 +1,145 @@
+#include "gaussian_beam.hpp"
+#include "source.hpp"
+#include <cmath>
+#include <vector>
+
+GaussianBeam::GaussianBeam(Source &src)
+    : axis(src.getPosition(), unit_vector(src.getOrientation())), mode(src.getFieldType()), l(src.getL()), p(src.getP()),
+      wavelength(src.getWavelength()), w0(src.getBeamWaist()), psi(src.getPsi()), delta(src.getDelta()), gouy(0.0), pathLength(0.0)
+{
+    // Waist at the source: q = -i z_R in the e^{+ikz} convention used by WaveFront
+    q = std::complex<double>(0.0, -PI * w0 * w0 / wavelength);
+}
+
+bool GaussianBeam::supports(Source &src)
+{
+    FieldType type = src.getFieldType();
+    if (type == FieldType::LG)
+    {
+        // WaveFront::initialize adds a linear phase for LG sources not pointing along z
+        vec3 dir = unit_vector(src.getOrientation());
+        return std::abs(dir.x()) < 1e-12 && std::abs(dir.y()) < 1e-12;
+    }
+    return type == FieldType::GAUSSIAN || type == FieldType::HG;
+}
+
+int GaussianBeam::order() const
+{
+    switch (mode)
+    {
+    case FieldType::HG:
+        return std::abs(l) + p;
+    case FieldType::LG:
+        return 2 * p + std::abs(l);
+    default:
+        return 0;
+    }
+}
+
+double GaussianBeam::getWidth() const
+{
+    return std::sqrt(wavelength / (PI * std::imag(1.0 / q)));
+}
+
+double GaussianBeam::getExtent() const
+{
+    return 3.0 * getWidth() * std::sqrt(order() + 1.0);
+}
+
+void GaussianBeam::applyABCD(double A, double B, double C, double D)
+{
+    std::complex<double> m = A + B / q;
+    gouy += std::arg(m);
+    q = (A * q + B) / (C * q + D);
+}
+
+void GaussianBeam::propagate(double z)
+{
+    applyABCD(1.0, z, 0.0, 1.0);
+    axis.propagate(z);
+    pathLength += z;
+}
+
+void GaussianBeam::applyLens(double f)
+{
+    applyABCD(1.0, 0.0, -1.0 / f, 1.0);
+}
+
+// The reflected field is the mirror image of the incident one (WaveFront::reflect), which only
+// rotationally symmetric modes leave unchanged: a vortex flips its charge and HG patterns turn
+bool GaussianBeam::reflect(vec3 n)
+{
+    const bool symmetric = mode == FieldType::GAUSSIAN || (mode == FieldType::LG && l == 0) || (mode == FieldType::HG && l == 0 && p == 0);
+    if (!symmetric)
+        return false;
+
+    axis.reflect(n);
+    return true;
+}
+
+void GaussianBeam::samplingHint(double &half_width, double &max_angle) const
+{
+    double w = getWidth();
+    double curvature = std::real(1.0 / q); // 1/R
+    half_width = getExtent();
+    max_angle = half_width * std::abs(curvature) + 3.0 * std::sqrt(order() + 1.0) * wavelength / (PI * w);
+}
+
+void GaussianBeam::rasterize(WaveFront &target) const
+{
+    const int N = target.N;
+    const double dx = target.getPixelSize();
+    const double k = 2 * PI / wavelength;
+    const double w = getWidth();
+    const std::complex<double> inv_q = 1.0 / q;
+    const std::complex<double> common = std::polar(w0 / w, k * pathLength - (order() + 1) * gouy);
+    const std::complex<double> pol_x = std::cos(psi);
+    const std::complex<double> pol_y = std::polar(1.0, delta) * std::sin(psi);
+
+    // Offset of the grid centre from the beam axis, in the target's frame
+    vec3 offset = target.getNormal().pos() - axis.pos();
+    const double du = dot(offset, target.u);
+    const double dv = dot(offset, target.v);
+
+    const double norm = sqrt(2.0 / (PI * w0 * w0));
+    const double scaleHG = std::exp(0.5 * (hermiteLogNorm(l) + hermiteLogNorm(p)));
+    const double normLG = sqrt(2.0 * factorial(p) / (PI * factorial(p + std::abs(l)))) / w0;
+
+    // exp(i k r^2 / 2q), the wavefront curvature times the envelope exp(-r^2 / w^2), factors into
+    // a row and a column part, and so do the HG mode functions: they are evaluated once per row
+    // and per column (same transverse axes as WaveFront::initialize: x along -v, y along -u)
+    std::vector<std::complex<double>> row(N), column(N);
+    const bool hg = mode == FieldType::HG;
+    auto factor = [&](double t, int order) {
+        std::complex<double> f = std::polar(1.0, 0.5 * k * t * t * std::real(inv_q));
+        return hg ? f * hermiteFunction(order, sqrt(2.0) * t / w) // The Hermite functions carry the envelope
+                  : f * std::exp(-0.5 * k * t * t * std::imag(inv_q));
+    };
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++)
+    {
+        row[i] = factor(-(du + (N / 2.0 - i) * dx), p);
+        column[i] = factor(-(dv + (N / 2.0 - i) * dx), l);
+    }
+    const std::complex<double> scale = common * (hg ? norm * scaleHG : mode == FieldType::LG ? normLG : norm);
+
+    FieldGrid::Rows &ex = target.Ex.write(), &ey = target.Ey.write();
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++)
+    {
+        const double y = -(du + (N / 2.0 - i) * dx);
+        const std::complex<double> a = scale * row[i];
+        for (int j = 0; j < N; j++)
+        {
+            std::complex<double> comp_amp = a * column[j];
+            if (mode == FieldType::LG)
+            {
+                double x = -(dv + (N / 2.0 - j) * dx);
+                double rho = sqrt(2.0 * (x * x + y * y)) / w;
+                comp_amp *= genLaguerre(p, std::abs(l), rho * rho) * pow(rho, std::abs(l)) * std::polar(1.0, l * atan2(y, x));
+            }
+            ex[i][j] += comp_amp * pol_x;
+            ey[i][j] += comp_amp * pol_y;
+        }
+    }
+}
@@ -1,5 +1,27 @@
 #include "lens.hpp"
 #include "utils.hpp"
+#include "gaussian_beam.hpp"
+#include "ray_bundle.hpp"
+
+// Thin-lens deflection of the listed rays: d += -power * (p - centre), renormalized
+static void deflectBundle(RayBundle &rays, const std::vector<int> &indices, const point3 &centre, double power)
+{
+    const int n = (int)indices.size();
+    const double cx = centre.x(), cy = centre.y(), cz = centre.z();
+
+#pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; k++)
+    {
+        int i = indices[k];
+        double x = rays.dx[i] - power * (rays.px[i] - cx);
+        double y = rays.dy[i] - power * (rays.py[i] - cy);
+        double z = rays.dz[i] - power * (rays.pz[i] - cz);
+        double inv = 1.0 / std::sqrt(x * x + y * y + z * z);
+        rays.dx[i] = x * inv;
+        rays.dy[i] = y * inv;
+        rays.dz[i] = z * inv;
+    }
+}
 
 ConvexLens::ConvexLens(vec3 position, vec3 orientation, std::string name, double diameter, double focalLength, double refractive_index)
     : OpticalElement(position, orientation, name), radius(diameter / 2.0), focalLength(focalLength), n(refractive_index) {}
@@ -31,27 +53,54 @@ void ConvexLens::interact_ray(ray &beamlet)
     beamlet.setDirection(new_dir);
 }
 
+void ConvexLens::hit_bundle(const RayBundle &rays, double *t)
+{
+    rays.intersectPlane(getPosition(), getOrientation(), t);
+    rays.clipDisc(getPosition(), radius, t);
+}
+
+void ConvexLens::interact_bundle(RayBundle &rays, const std::vector<int> &indices)
+{
+    deflectBundle(rays, indices, getPosition(), 1.0 / focalLength);
+}
+
 void ConvexLens::interact_wavefront(WaveFront &A)
 {
-    double k = 2 * PI / A.getWavelength();
+    FieldSlab slab(A);
+    interact_slab(slab);
+}
+
+bool ConvexLens::interact_slab(FieldSlab &slab)
+{
+    double k = 2 * PI / slab.wavelength;
     double prefactor = -k / (2.0 * focalLength);
 
-    for (int i = 0; i < A.N; i++)
+    for (int i = 0; i < slab.count(); i++)
     {
-        double x = (i - A.N / 2) * A.getPixelSize();
-        for (int j = 0; j < A.N; j++)
+        double x = (slab.first + i - slab.centre) * slab.pixel_size;
+        for (int j = 0; j < slab.n; j++)
         {
-            double y = (j - A.N / 2) * A.getPixelSize();
+            double y = (j - slab.centre) * slab.pixel_size;
             double r2 = x * x + y * y;
 
             if (r2 <= radius * radius)
             {
                 std::complex<double> lens_phasor = std::polar(1.0, prefactor * r2);
-                A.Ex[i][j] *= lens_phasor;
-                A.Ey[i][j] *= lens_phasor;
+                slab.ex[i][j] *= lens_phasor;
+                slab.ey[i][j] *= lens_phasor;
             }
         }
     }
+    return true;
+}
+
+bool ConvexLens::interact_beam(GaussianBeam &beam)
+{
+    if (beam.getExtent() > radius)
+        return false; // The rim clips the beam
+
+    beam.applyLens(focalLength);
+    return true;
 }
 
 ConcaveLens::ConcaveLens(vec3 position, vec3 orientation, std::string name, double diameter, double focalLength, double refractive_index)
@@ -84,29 +133,56 @@ void ConcaveLens::interact_ray(ray &beamlet)
     beamlet.setDirection(new_dir);
 }
 
+void ConcaveLens::hit_bundle(const RayBundle &rays, double *t)
+{
+    rays.intersectPlane(getPosition(), getOrientation(), t);
+    rays.clipDisc(getPosition(), radius, t);
+}
+
+void ConcaveLens::interact_bundle(RayBundle &rays, const std::vector<int> &indices)
+{
+    deflectBundle(rays, indices, getPosition(), -1.0 / focalLength);
+}
+
 void ConcaveLens::interact_wavefront(WaveFront &A)
 {
-    double k = 2 * PI / A.getWavelength();
+    FieldSlab slab(A);
+    interact_slab(slab);
+}
+
+bool ConcaveLens::interact_slab(FieldSlab &slab)
+{
+    double k = 2 * PI / slab.wavelength;
     double prefactor = k / (2.0 * focalLength);
 
-    for (int i = 0; i < A.N; i++)
+    for (int i = 0; i < slab.count(); i++)
     {
-        double x = (i - A.N / 2) * A.getPixelSize();
-        for (int j = 0; j < A.N; j++)
+        double x = (slab.first + i - slab.centre) * slab.pixel_size;
+        for (int j = 0; j < slab.n; j++)
         {
-            double y = (j - A.N / 2) * A.getPixelSize();
+            double y = (j - slab.centre) * slab.pixel_size;
             double r2 = x * x + y * y;
 
             if (r2 <= radius * radius)
             {
                 std::complex<double> lens_phasor = std::polar(1.0, prefactor * r2);
-                A.Ex[i][j] *= lens_phasor;
-                A.Ey[i][j] *= lens_phasor;
+                slab.ex[i][j] *= lens_phasor;
+                slab.ey[i][j] *= lens_phasor;
             }
             else {
-                A.Ex[i][j] *= 0;
-                A.Ey[i][j] *= 0;
+                slab.ex[i][j] *= 0;
+                slab.ey[i][j] *= 0;
             }
         }
     }
+    return true;
+}
+
+bool ConcaveLens::interact_beam(GaussianBeam &beam)
+{
+    if (beam.getExtent() > radius)
+        return false;
+
+    beam.applyLens(-focalLength);
+    return true;
 }
\ No newline at end of file
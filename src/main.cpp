@@ -3,6 +3,10 @@
 #include <string>
 #include <cmath>
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -12,10 +16,18 @@
 #include "imgui_internal.h"
 #include "implot.h"
 
+#include "buffer_pool.hpp"
+#include "progressive_simulation.hpp"
 #include "vec3.hpp"
 #include "texture_manager.hpp"
 #include "scene.hpp"
 #include "simulation_engine.hpp"
+#include "ray_tracer.hpp"
+#include "simulation_server.hpp"
+#include "sweep_coordinator.hpp"
+#include "distributed_wavefront.hpp"
+#include "out_of_core_wavefront.hpp"
+#include "serialization.hpp"
 #include "optical_element.hpp"
 #include "utils.hpp"
 
@@ -157,47 +169,120 @@ ImVec2 RotatePoint(ImVec2 point, ImVec2 center, float angle_rad)
     return ImVec2(xnew + center.x, ynew + center.y);
 }
 
-void UpdateGPUTexture(GLuint &texID, const std::vector<double> &data, int w, int h, double maxVal, bool isPhase)
+// Colormaps sampled once into packed RGBA tables. The intensity table has the display's gamma-0.5
+// curve baked in, so rasterizing a pixel is one multiply and one lookup
+const int INTENSITY_LUT_SIZE = 4096;
+const int PHASE_LUT_SIZE = 1024;
+
+static std::vector<uint32_t> BuildColormapLUT(ImPlotColormap map, int size, bool gamma)
+{
+    std::vector<uint32_t> lut(size);
+    for (int k = 0; k < size; k++)
+    {
+        float t = (float)k / (float)(size - 1);
+        ImVec4 c = ImPlot::SampleColormap(gamma ? sqrtf(t) : t, map);
+        unsigned char rgba[4] = {(unsigned char)(c.x * 255), (unsigned char)(c.y * 255), (unsigned char)(c.z * 255), 255};
+        memcpy(&lut[k], rgba, 4);
+    }
+    return lut;
+}
+
+// Camera texture streamed through two pixel buffer objects. Storage is allocated once per size;
+// each update is rasterized straight into the mapped PBO the GPU is not reading from and copied
+// into the texture with glTexSubImage2D, which returns without waiting for the transfer
+struct StreamedTexture
+{
+    GLuint id = 0;
+    GLuint pbo[2] = {0, 0};
+    int width = 0, height = 0;
+    int next = 0; // PBO written by the next update
+};
+
+static void RasterizeColormap(uint32_t *dst, const std::vector<double> &data, int count, double maxVal, bool isPhase)
+{
+    // Built on first use, once ImPlot's colormaps exist
+    static const std::vector<uint32_t> intensityLUT = BuildColormapLUT(ImPlotColormap_Plasma, INTENSITY_LUT_SIZE, true);
+    static const std::vector<uint32_t> phaseLUT = BuildColormapLUT(ImPlotColormap_Twilight, PHASE_LUT_SIZE, false);
+
+    const std::vector<uint32_t> &lut = isPhase ? phaseLUT : intensityLUT;
+    const int last = (int)lut.size() - 1;
+    const double offset = isPhase ? PI : 0.0;
+    const double scale = isPhase ? last / (2.0 * PI) : (maxVal > 0 ? last / maxVal : 0.0);
+
+#pragma omp parallel for schedule(static)
+    for (int k = 0; k < count; k++)
+    {
+        int index = (int)((data[k] + offset) * scale + 0.5);
+        dst[k] = lut[min(max(index, 0), last)];
+    }
+}
+
+void UpdateGPUTexture(StreamedTexture &tex, const std::vector<double> &data, int w, int h, double maxVal, bool isPhase)
 {
     if (data.empty())
         return;
 
-    std::vector<unsigned char> pixels;
-    pixels.reserve(w * h * 4);
+    const GLsizeiptr bytes = (GLsizeiptr)w * h * sizeof(uint32_t);
 
-    for (double val : data)
+    if (tex.id == 0 || tex.width != w || tex.height != h)
     {
-        ImVec4 c;
-        if (isPhase)
+        if (tex.id == 0)
         {
-            float norm = (float)((val + PI) / (2.0 * PI));
-            c = ImPlot::SampleColormap(norm, ImPlotColormap_Twilight);
+            glGenTextures(1, &tex.id);
+            glGenBuffers(2, tex.pbo);
         }
-        else
+        glBindTexture(GL_TEXTURE_2D, tex.id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        for (GLuint pbo : tex.pbo)
         {
-            float norm = (maxVal > 0) ? (float)(val / maxVal) : 0.0f;
-            norm = powf(norm, 0.5f);
-            c = ImPlot::SampleColormap(norm, ImPlotColormap_Plasma);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
         }
-        pixels.push_back((unsigned char)(c.x * 255));
-        pixels.push_back((unsigned char)(c.y * 255));
-        pixels.push_back((unsigned char)(c.z * 255));
-        pixels.push_back(255);
+        tex.width = w;
+        tex.height = h;
     }
 
-    if (texID == 0)
-        glGenTextures(1, &texID);
-    glBindTexture(GL_TEXTURE_2D, texID);
+    // Orphaning the buffer lets the driver hand out fresh memory if a previous upload is in flight
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, tex.pbo[tex.next]);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glBindTexture(GL_TEXTURE_2D, tex.id);
+    if (mapped)
+    {
+        RasterizeColormap((uint32_t *)mapped, data, w * h, maxVal, isPhase);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, nullptr); // Sources the bound PBO
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    else
+    {
+        // Mapping failed: upload synchronously from a staging buffer
+        static std::vector<uint32_t> pixels;
+        pixels.resize(w * h);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        RasterizeColormap(pixels.data(), data, w * h, maxVal, isPhase);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    }
     glBindTexture(GL_TEXTURE_2D, 0);
+
+    tex.next ^= 1;
 }
 
-void UpdateCameraTextures(Camera *cam, GLuint &texIntensity, GLuint &texPhase)
+void ReleaseStreamedTexture(StreamedTexture &tex)
+{
+    if (tex.id == 0)
+        return;
+    glDeleteTextures(1, &tex.id);
+    glDeleteBuffers(2, tex.pbo);
+    tex = StreamedTexture();
+}
+
+void UpdateCameraTextures(Camera *cam, StreamedTexture &texIntensity, StreamedTexture &texPhase)
 {
     if (!cam)
         return;
@@ -206,30 +291,15 @@ void UpdateCameraTextures(Camera *cam, GLuint &texIntensity, GLuint &texPhase)
     if (N <= 0)
         return;
 
-    auto &gridI = cam->getSensedWaveFront().Intensity();
-    auto &gridP = cam->getSensedWaveFront().Phase();
-
-    std::vector<double> flatI;
-    std::vector<double> flatP;
-    flatI.reserve(N * N);
-    flatP.reserve(N * N);
+    // Reused across refreshes; filled in a single pass over the field
+    static std::vector<double> flatI, flatP;
+    flatI.resize(N * N);
+    flatP.resize(N * N);
 
-    double maxI = 0.0;
+    FieldStatistics stats = cam->getSensedWaveFront().sampleMaps(flatI.data(), flatP.data());
 
-    for (int i = 0; i < N; i++)
-    {
-        for (int j = 0; j < N; j++)
-        {
-            double valI = gridI[i][j];
-            if (valI > maxI)
-                maxI = valI;
-            flatI.push_back(valI);
-            flatP.push_back(gridP[i][j]);
-        }
-    }
-
-    UpdateGPUTexture(texIntensity, flatI, N, N, maxI, false); // False = Intensity
-    UpdateGPUTexture(texPhase, flatP, N, N, 0, true);         // True = Phase
+    UpdateGPUTexture(texIntensity, flatI, N, N, stats.maxIntensity, false); // False = Intensity
+    UpdateGPUTexture(texPhase, flatP, N, N, 0, true);                      // True = Phase
 }
 
 struct ElementType
@@ -249,8 +319,136 @@ const std::vector<ElementType> ELEMENT_REGISTRY = {
     {"Iris", "Iris", "icons/iris.png", "Controls the aperture of the optical system"},
     {"Slit", "Slit", "icons/slits.png", "Creates single or multi slits in the optical path"}};
 
-int main()
+int main(int argc, char **argv)
 {
+    // Headless: OpticalSimulationLab --serve [port] [--any] runs scene jobs sent over a socket
+    // (from this machine only, unless --any)
+    if (argc > 1 && std::strcmp(argv[1], "--serve") == 0)
+    {
+        int port = argc > 2 ? std::atoi(argv[2]) : 7878;
+        bool any = argc > 3 && std::strcmp(argv[3], "--any") == 0;
+        SimulationServer server;
+        if (!server.Start(port, !any))
+            return 1;
+        std::cout << "[SimulationServer] Listening on " << (any ? "all interfaces" : "127.0.0.1") << ", port " << server.getPort() << std::endl;
+        server.Serve();
+        return 0;
+    }
+
+    // Headless: OpticalSimulationLab --sweep <spec> <host:port,...> <archive> [checkpoint]
+    // shards a parameter sweep across servers started with --serve
+    if (argc > 1 && std::strcmp(argv[1], "--sweep") == 0)
+    {
+        if (argc < 5)
+        {
+            std::cerr << "usage: " << argv[0] << " --sweep <spec> <host:port,...> <archive> [checkpoint]" << std::endl;
+            return 1;
+        }
+        std::ifstream in(argv[2]);
+        SweepSpec spec;
+        std::vector<SweepCoordinator::Worker> workers;
+        std::string error;
+        if (!in || !ReadSweep(in, spec, error) || !SweepCoordinator::ParseWorkers(argv[3], workers, error))
+        {
+            std::cerr << "[SweepCoordinator] " << (in ? error : std::string("cannot read ") + argv[2]) << std::endl;
+            return 1;
+        }
+        std::string archive = argv[4];
+        std::string checkpoint = argc > 5 ? argv[5] : archive + ".done";
+
+        SweepCoordinator coordinator;
+        bool ok = coordinator.Run(spec, workers, archive, checkpoint, error);
+        std::cout << "[SweepCoordinator] " << coordinator.getCompleted() << " of " << spec.jobCount() << " jobs in " << archive
+                  << ", " << coordinator.getFailed() << " rejected" << std::endl;
+        if (!ok)
+            std::cerr << "[SweepCoordinator] " << error << std::endl;
+        return ok && coordinator.getFailed() == 0 ? 0 : 1;
+    }
+
+    // Headless: OpticalSimulationLab --out-of-core <scene> <output> [N] [scratch dir] [memory MiB]
+    // simulates the scene on N x N fields kept in scratch files, for grids larger than memory;
+    // every camera's field goes to output as CAMERA <id> <bytes> records, like the server's reply.
+    // The scene has to turn analytic beams and adaptive sampling off
+    if (argc > 1 && std::strcmp(argv[1], "--out-of-core") == 0)
+    {
+        if (argc < 4)
+        {
+            std::cerr << "usage: " << argv[0] << " --out-of-core <scene> <output> [N] [scratch dir] [memory MiB]" << std::endl;
+            return 1;
+        }
+        Scene scene;
+        SimulationSettings settings;
+        std::string error;
+        std::ifstream in(argv[2]);
+        if (!in)
+            error = std::string("cannot read ") + argv[2];
+        else if (ReadScene(in, scene, settings, error))
+        {
+            int N = argc > 4 ? std::atoi(argv[4]) : 0;
+            std::string scratch = argc > 5 ? argv[5] : "";
+            size_t budget = (size_t)(argc > 6 ? std::atoi(argv[6]) : 1024) << 20;
+            if (OutOfCoreSimulation::Run(scene, settings, N, scratch, budget, error))
+            {
+                std::ofstream out(argv[3], std::ios::binary);
+                WriteCameraFields(out, scene);
+                if (!out)
+                    error = std::string("cannot write ") + argv[3];
+            }
+        }
+        if (!error.empty())
+            std::cerr << "[OutOfCoreSimulation] " << error << std::endl;
+        return error.empty() ? 0 : 1;
+    }
+
+#ifdef OSL_MPI
+    // Headless: mpirun -np <ranks> OpticalSimulationLab --distributed <scene> <output> [N] simulates
+    // the scene on N x N fields split over the ranks; rank 0 writes every camera's field to output
+    // as CAMERA <id> <bytes> records, like the server's reply. The scene has to turn analytic
+    // beams and adaptive sampling off
+    if (argc > 1 && std::strcmp(argv[1], "--distributed") == 0)
+    {
+        MPI_Init(&argc, &argv);
+        fftw_mpi_init();
+        int rank;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+        Scene scene;
+        SimulationSettings settings;
+        std::string error = argc < 4 ? "usage: " + std::string(argv[0]) + " --distributed <scene> <output> [N]" : "";
+        if (error.empty())
+        {
+            std::ifstream in(argv[2]);
+            if (!in)
+                error = std::string("cannot read ") + argv[2];
+            else
+                ReadScene(in, scene, settings, error);
+        }
+
+        // Every rank has to take part in the run, so they stop together if any could not read the scene
+        int ok = error.empty(), allOk = 0;
+        MPI_Allreduce(&ok, &allOk, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+        if (allOk && !DistributedSimulation::Run(scene, settings, argc > 4 ? std::atoi(argv[4]) : 0, MPI_COMM_WORLD, error))
+            allOk = 0;
+
+        if (rank == 0 && allOk)
+        {
+            std::ofstream out(argv[3], std::ios::binary);
+            WriteCameraFields(out, scene);
+            if (!out)
+            {
+                error = std::string("cannot write ") + argv[3];
+                allOk = 0;
+            }
+        }
+        if (!error.empty() && (rank == 0 || !ok)) // The run's errors are the same on every rank
+            std::cerr << "[DistributedSimulation] Rank " << rank << ": " << error << std::endl;
+
+        fftw_mpi_cleanup();
+        MPI_Finalize();
+        return allOk ? 0 : 1;
+    }
+#endif
+
     if (!glfwInit())
         return 1;
     const char *glsl_version = "#version 130";
@@ -280,14 +478,22 @@ int main()
     ImGui_ImplOpenGL3_Init(glsl_version);
 
     TextureManager icons;
+    GLuint kindIcons[(int)ElementKind::COUNT + 1] = {}; // Icon per element kind, 0 (none) for unknown kinds
     for (const auto &el : ELEMENT_REGISTRY)
+    {
         icons.Load(el.typeID, el.iconPath);
+        kindIcons[(int)ParseElementKind(el.typeID)] = icons.GetID(el.typeID);
+    }
 
     ImFont *mainFont = io.Fonts->AddFontFromFileTTF("icons/Helvetica.ttf", 18.0f);
 
     Scene scene;
-    GLuint texIntensity = 0;
-    GLuint texPhase = 0;
+    SimulationSettings settings;
+    RayTraceSettings rayTrace;
+    ProgressiveSimulation preview;
+    bool livePreview = false;
+    StreamedTexture texIntensity;
+    StreamedTexture texPhase;
 
     ImVec2 canvas_offset = ImVec2(100, 300);
     float canvas_scale = 10000.0f;
@@ -302,6 +508,7 @@ int main()
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
+        bool sceneEdited = false; // Set by canvas edits; widget edits are picked up from ImGui below
 
         const ImGuiViewport *viewport = ImGui::GetMainViewport();
         ImGui::DockSpaceOverViewport(viewport->ID, viewport);
@@ -395,10 +602,17 @@ int main()
                     double dropZ = (mousePos.x - p0.x - canvas_offset.x) / canvas_scale;
                     double dropX = -(mousePos.y - p0.y - canvas_offset.y) / canvas_scale;
                     scene.AddObject(type, vec3(dropX, 0, dropZ), vec3(0, 0, 1));
+                    sceneEdited = true;
                 }
                 ImGui::EndDragDropTarget();
             }
 
+            if (scene.selectedObject && ImGui::IsWindowFocused() && ImGui::IsKeyPressed(ImGuiKey_Delete))
+            {
+                scene.RemoveObject(scene.selectedObject->id);
+                sceneEdited = true;
+            }
+
             for (auto &obj : scene.GetObjects())
             {
                 vec3 pos = obj->getPosition();
@@ -416,7 +630,7 @@ int main()
                 ImVec2 p_br = RotatePoint(ImVec2(screenX + halfSize, screenY + halfSize), center, angle);
                 ImVec2 p_bl = RotatePoint(ImVec2(screenX - halfSize, screenY + halfSize), center, angle);
 
-                GLuint texID = icons.GetID(obj->type);
+                GLuint texID = kindIcons[(int)obj->kind];
                 if (texID != 0)
                     draw_list->AddImageQuad((void *)(intptr_t)texID, p_tl, p_tr, p_br, p_bl);
                 else
@@ -442,6 +656,7 @@ int main()
                         obj->source->setPosition(newPos);
                     if (obj->element)
                         obj->element->setPosition(newPos);
+                    sceneEdited = true;
                 }
                 ImGui::PopID();
             }
@@ -455,17 +670,43 @@ int main()
         {
             if (ImGui::Button("SIMULATE", ImVec2(200, 40)))
             {
+                preview.Stop(); // FFTW planning is not thread-safe, and the full run supersedes the preview
                 std::vector<OpticalElement *> cameras = scene.GetCameras();
                 for (auto &cam : cameras)
                     cam->reset();
                 auto objects = scene.GetObjects();
 
-                SimulationEngine::Run(scene);
+                SimulationEngine::Run(scene, settings);
                 needTextureUpdate = true; // Trigger update from C++ arrays
             }
             ImGui::SameLine();
+            if (ImGui::Button("TRACE RAYS", ImVec2(200, 40)))
+                RayTracer::Trace(scene, rayTrace);
+            ImGui::SameLine();
             if (ImGui::Button("CLEAR SETUP", ImVec2(200, 40)))
+            {
+                preview.Stop();
                 scene.Clear();
+                BufferPool::instance().trim();
+            }
+            ImGui::SameLine();
+            ImGui::Checkbox("Adaptive Sampling", &settings.adaptiveSampling);
+            ImGui::SameLine();
+            ImGui::Checkbox("Analytic Beams", &settings.analyticBeams);
+            ImGui::SameLine();
+            if (ImGui::Checkbox("Live Preview", &livePreview) && !livePreview)
+                preview.Stop();
+            if (livePreview && preview.getDivisor() > 0)
+            {
+                ImGui::SameLine();
+                ImGui::TextDisabled("1/%d resolution%s", preview.getDivisor(), preview.isRefining() ? ", refining..." : "");
+            }
+            ImGui::SetNextItemWidth(200);
+            if (ImGui::InputInt("Rays per Source", &rayTrace.raysPerSource, 10000, 100000))
+                rayTrace.raysPerSource = max(1, rayTrace.raysPerSource);
+            BufferPoolStats poolStats = BufferPool::instance().getStats();
+            ImGui::TextDisabled("FFT buffers: %.1f MB peak, %.1f MB idle, %zu allocations, %zu reuses",
+                                poolStats.peakBytesInUse / 1048576.0, poolStats.bytesIdle / 1048576.0, poolStats.heapAllocations, poolStats.reuses);
 
             ImGui::Separator();
             if (scene.selectedObject)
@@ -502,7 +743,7 @@ int main()
 
                 ImGui::Separator();
                 ImGui::Spacing();
-                if (obj->type == "Source" && obj->source)
+                if (obj->kind == ElementKind::SOURCE)
                 {
                     auto src = obj->source;
                     const char *types[] = {"Plane Waves", "Gaussian", "Laguerre-Gaussian (LG)", "Hermite-Gaussian (HG)"};
@@ -527,16 +768,62 @@ int main()
                     float wave_nm = (float)(src->getWavelength() * 1e9);
                     if (DrawFloatControl("Wavelength", &wave_nm, true, "nm"))
                         src->setWavelength(wave_nm * 1e-9);
+                    float bandwidth_nm = (float)(src->getBandwidth() * 1e9);
+                    if (DrawFloatControl("Bandwidth (FWHM)", &bandwidth_nm, true, "nm"))
+                        src->setBandwidth(bandwidth_nm * 1e-9);
+                    if (src->getBandwidth() > 0.0)
+                    {
+                        int samples = src->getSpectralSamples();
+                        if (ImGui::InputInt("Spectral Samples", &samples))
+                            src->setSpectralSamples(samples);
+                    }
                     if (src->getFieldType() != FieldType::PLANE)
                     {
                         float waist_mm = (float)(src->getBeamWaist() * 1000.0);
                         if (DrawFloatControl("Waist", &waist_mm, true, "mm"))
                             src->setBeamWaist(waist_mm / 1000.0);
                     }
+                    if (src->getFieldType() == FieldType::GAUSSIAN)
+                    {
+                        float coherence_mm = (float)(src->getCoherenceWidth() * 1000.0);
+                        if (DrawFloatControl("Coherence Width", &coherence_mm, true, "mm"))
+                            src->setCoherenceWidth(coherence_mm / 1000.0);
+                        if (src->isPartiallyCoherent())
+                        {
+                            float threshold = (float)src->getModeThreshold();
+                            if (DrawFloatControl("Mode Threshold", &threshold, true))
+                                src->setModeThreshold(threshold);
+
+                            int maxModes = src->getMaxModes();
+                            if (ImGui::InputInt("Max Modes", &maxModes))
+                                src->setMaxModes(maxModes);
+
+                            // The decomposition only changes with these parameters, not from frame to frame
+                            static const Source *modesOf = nullptr;
+                            static double modesKey[4] = {};
+                            static size_t modeCount = 0;
+                            static double modesDropped = 0.0;
+                            const double key[4] = {src->getBeamWaist(), src->getCoherenceWidth(), src->getModeThreshold(), (double)src->getMaxModes()};
+                            if (modesOf != src || !std::equal(key, key + 4, modesKey))
+                            {
+                                std::vector<int> m, n;
+                                std::vector<double> weights;
+                                double waist;
+                                src->sampleModes(m, n, weights, waist, modesDropped);
+                                modeCount = weights.size();
+                                modesOf = src;
+                                std::copy(key, key + 4, modesKey);
+                            }
+                            ImGui::TextDisabled("%zu coherent modes retained, %.1f%% of the power dropped", modeCount, 100.0 * modesDropped);
+                        }
+                    }
+                    float guard = (float)src->getGuardFactor();
+                    if (DrawFloatControl("Guard Factor", &guard, true))
+                        src->setGuardFactor(guard);
                 }
-                else if (obj->type == "Mirror" && obj->element)
+                else if (obj->kind == ElementKind::MIRROR)
                 {
-                    Mirror *mirror = dynamic_cast<Mirror *>(obj->element.get());
+                    Mirror *mirror = static_cast<Mirror *>(obj->element.get());
 
                     if (mirror)
                     {
@@ -577,10 +864,10 @@ int main()
                         }
                     }
                 }
-                else if (obj->type == "ConvexLens" || obj->type == "ConcaveLens")
+                else if (obj->kind == ElementKind::CONVEX_LENS || obj->kind == ElementKind::CONCAVE_LENS)
                 {
-                    ConvexLens *cvx = dynamic_cast<ConvexLens *>(obj->element.get());
-                    ConcaveLens *ccv = dynamic_cast<ConcaveLens *>(obj->element.get());
+                    ConvexLens *cvx = obj->kind == ElementKind::CONVEX_LENS ? static_cast<ConvexLens *>(obj->element.get()) : nullptr;
+                    ConcaveLens *ccv = obj->kind == ElementKind::CONCAVE_LENS ? static_cast<ConcaveLens *>(obj->element.get()) : nullptr;
 
                     if (cvx || ccv)
                     {
@@ -622,9 +909,9 @@ int main()
                         }
                     }
                 }
-                else if (obj->type == "Iris")
+                else if (obj->kind == ElementKind::IRIS)
                 {
-                    if (Iris *iris = dynamic_cast<Iris *>(obj->element.get()))
+                    if (Iris *iris = static_cast<Iris *>(obj->element.get()))
                     {
                         float size_mm = (float)(iris->getSize() * 1000.0);
                         if (DrawFloatControl("Mount Size", &size_mm, true, "mm"))
@@ -637,9 +924,9 @@ int main()
                         ImGui::TextDisabled("Hole Diameter: %.3f mm", radius_mm * 2.0f);
                     }
                 }
-                else if (obj->type == "Slit")
+                else if (obj->kind == ElementKind::SLIT)
                 {
-                    if (Slit *slit = dynamic_cast<Slit *>(obj->element.get()))
+                    if (Slit *slit = static_cast<Slit *>(obj->element.get()))
                     {
                         float size_mm = (float)(slit->getSize() * 1000.0);
                         if (DrawFloatControl("Mount Size", &size_mm, true, "mm"))
@@ -675,21 +962,56 @@ int main()
                         }
                     }
                 }
+                else if (obj->kind == ElementKind::CAMERA)
+                {
+                    if (Camera *cam = static_cast<Camera *>(obj->element.get()))
+                    {
+                        float size_mm = (float)(cam->getSize() * 1000.0);
+                        if (DrawFloatControl("Sensor Size", &size_mm, true, "mm"))
+                            cam->setSize(size_mm / 1000.0);
+
+                        int resolution = cam->getResolution();
+                        if (ImGui::InputInt("Resolution", &resolution))
+                            cam->setResolution(max(16, resolution));
+
+                        bool zoom = cam->getZoomPropagation();
+                        if (ImGui::Checkbox("Zoom Propagation", &zoom))
+                            cam->setZoomPropagation(zoom);
+
+                        ImGui::Separator();
+                        ImGui::Text("Region of Interest");
+
+                        float roi_mm = (float)(cam->getROISize() * 1000.0);
+                        float roi_x_mm = (float)(cam->getROIX() * 1000.0);
+                        float roi_y_mm = (float)(cam->getROIY() * 1000.0);
+
+                        bool roi_changed = false;
+                        if (DrawFloatControl("ROI Width", &roi_mm, true, "mm"))
+                            roi_changed = true;
+                        if (DrawFloatControl("ROI Centre X", &roi_x_mm, true, "mm"))
+                            roi_changed = true;
+                        if (DrawFloatControl("ROI Centre Y", &roi_y_mm, true, "mm"))
+                            roi_changed = true;
+
+                        if (roi_changed)
+                            cam->setROI(max(1e-6, roi_mm / 1000.0), roi_x_mm / 1000.0, roi_y_mm / 1000.0);
+                    }
+                }
             }
         }
         ImGui::End();
 
+        // Live preview: restart from the coarsest level whenever the setup changed this frame
+        sceneEdited |= ImGui::GetCurrentContext()->ActiveIdHasBeenEditedThisFrame;
+        if (livePreview && sceneEdited)
+            preview.Request(scene, settings);
+        if (preview.Collect(scene))
+            needTextureUpdate = true;
+
         // PANEL 4: SIMULATION OUTPUT (Right)
         ImGui::Begin("Simulation Output");
 
-        std::vector<OpticalElement *> sensors = scene.GetCameras();
-        std::vector<Camera *> cameras;
-        for (auto &sensor : sensors)
-        {
-            Camera *cam = dynamic_cast<Camera *>(sensor);
-            if (cam != nullptr)
-                cameras.push_back(cam);
-        }
+        std::vector<Camera *> cameras = scene.GetSensors();
 
         if (cameras.empty())
             ImGui::TextColored(ImVec4(1, 1, 0, 1), "No Cameras in Scene.");
@@ -722,19 +1044,21 @@ int main()
                 lastSelectedCameraIndex = selectedCameraIndex;
             }
 
-            if (texIntensity != 0 && activeCam->getSensedWaveFront().N > 0)
+            if (texIntensity.id != 0 && activeCam->getSensedWaveFront().N > 0)
             {
-                float size = (float)(activeCam->getSize() * 1000.0); // Convert to mm
+                float size = (float)(activeCam->getROISize() * 1000.0); // Convert to mm
                 float half = size / 2.0f;
-                ImPlotPoint min_b = {-half, -half};
-                ImPlotPoint max_b = {half, half};
+                float cx = (float)(activeCam->getROIX() * 1000.0);
+                float cy = (float)(activeCam->getROIY() * 1000.0);
+                ImPlotPoint min_b = {cx - half, cy - half};
+                ImPlotPoint max_b = {cx + half, cy + half};
 
                 ImPlot::PushColormap(ImPlotColormap_Plasma);
 
                 if (ImPlot::BeginPlot("Intensity (a.u.)", ImVec2(-1, 0), ImPlotFlags_Equal))
                 {
                     ImPlot::SetupAxes("x (mm)", "y (mm)");
-                    ImPlot::PlotImage("##Intensity", (void *)(intptr_t)texIntensity, min_b, max_b);
+                    ImPlot::PlotImage("##Intensity", (void *)(intptr_t)texIntensity.id, min_b, max_b);
                     ImPlot::EndPlot();
                 }
 
@@ -748,7 +1072,7 @@ int main()
                 if (ImPlot::BeginPlot("Phase (rad)", ImVec2(-1, 0), ImPlotFlags_Equal))
                 {
                     ImPlot::SetupAxes("x (mm)", "y (mm)");
-                    ImPlot::PlotImage("##Phase", (void *)(intptr_t)texPhase, min_b, max_b);
+                    ImPlot::PlotImage("##Phase", (void *)(intptr_t)texPhase.id, min_b, max_b);
                     ImPlot::EndPlot();
                 }
 
@@ -757,6 +1081,47 @@ int main()
             }
             else
                 ImGui::TextDisabled("No simulation data available. Click 'SIMULATE'.");
+
+            const std::vector<double> &spotX = activeCam->getSpotX();
+            const std::vector<double> &spotY = activeCam->getSpotY();
+            if (!spotX.empty())
+            {
+                // Spot diagram in mm about the centroid, with its RMS radius
+                static std::vector<float> xs, ys;
+                double cx = 0.0, cy = 0.0;
+                for (size_t i = 0; i < spotX.size(); i++)
+                {
+                    cx += spotX[i];
+                    cy += spotY[i];
+                }
+                cx /= spotX.size();
+                cy /= spotX.size();
+
+                // Every ray enters the RMS radius; at most ~20k of them are drawn
+                const size_t stride = max((size_t)1, spotX.size() / 20000);
+                double r2 = 0.0;
+                xs.clear();
+                ys.clear();
+                for (size_t i = 0; i < spotX.size(); i++)
+                {
+                    r2 += sq(spotX[i] - cx) + sq(spotY[i] - cy);
+                    if (i % stride == 0)
+                    {
+                        xs.push_back((float)((spotX[i] - cx) * 1000.0));
+                        ys.push_back((float)((spotY[i] - cy) * 1000.0));
+                    }
+                }
+
+                ImGui::Separator();
+                ImGui::Text("Spot diagram: %zu rays, RMS radius %.3f um", spotX.size(), std::sqrt(r2 / spotX.size()) * 1e6);
+                if (ImPlot::BeginPlot("Spot Diagram", ImVec2(-1, 0), ImPlotFlags_Equal))
+                {
+                    ImPlot::SetupAxes("x (mm)", "y (mm)", ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+                    ImPlot::SetNextMarkerStyle(ImPlotMarker_Circle, 1.0f);
+                    ImPlot::PlotScatter("##Spots", xs.data(), ys.data(), (int)xs.size());
+                    ImPlot::EndPlot();
+                }
+            }
         }
         ImGui::End();
 
@@ -770,8 +1135,8 @@ int main()
         glfwSwapBuffers(window);
     }
 
-    glDeleteTextures(1, &texIntensity);
-    glDeleteTextures(1, &texPhase);
+    ReleaseStreamedTexture(texIntensity);
+    ReleaseStreamedTexture(texPhase);
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImPlot::DestroyContext();
@@ -0,0 +1,106 @@
+#include "mapped_file.hpp"
+#include <cstdlib>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::create(const std::string &directory, size_t size)
+{
+    close();
+    if (size == 0)
+        return false;
+
+#ifdef _WIN32
+    char temp[MAX_PATH + 1], name[MAX_PATH + 1];
+    std::string dir = directory;
+    if (dir.empty())
+    {
+        if (GetTempPathA(sizeof(temp), temp) == 0)
+            return false;
+        dir = temp;
+    }
+    if (GetTempFileNameA(dir.c_str(), "osl", 0, name) == 0)
+        return false;
+
+    // Re-opened to be deleted on close; the system keeps temporary files in its cache while it can
+    HANDLE file = CreateFileA(name, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        DeleteFileA(name);
+        return false;
+    }
+    handle = (long long)file;
+
+    // The mapping extends the file to its size, zero-filled
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)(size & 0xFFFFFFFFu), nullptr);
+    if (mapping)
+        view = (char *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+    std::string dir = directory;
+    if (dir.empty())
+    {
+        const char *tmp = std::getenv("TMPDIR");
+        dir = tmp && *tmp ? tmp : "/tmp";
+    }
+    std::string pattern = dir + "/oslfield.XXXXXX";
+    std::vector<char> name(pattern.begin(), pattern.end());
+    name.push_back('\0');
+
+    int fd = mkstemp(name.data());
+    if (fd == -1)
+        return false;
+    unlink(name.data()); // Only the descriptor and the mapping refer to it from now on
+    handle = fd;
+
+    // Reserving the blocks up front fails here if the disk is too small, rather than with a
+    // SIGBUS when a page is first written back
+#ifdef __linux__
+    bool sized = posix_fallocate(fd, 0, (off_t)size) == 0;
+#else
+    bool sized = ftruncate(fd, (off_t)size) == 0;
+#endif
+    if (sized)
+    {
+        void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+            view = (char *)p;
+    }
+#endif
+
+    if (!view)
+    {
+        close();
+        return false;
+    }
+    bytes = size;
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (view)
+        UnmapViewOfFile(view);
+    if (mapping)
+        CloseHandle((HANDLE)mapping);
+    if (handle != -1)
+        CloseHandle((HANDLE)handle);
+#else
+    if (view)
+        munmap(view, bytes);
+    if (handle != -1)
+        ::close((int)handle);
+#endif
+    view = nullptr;
+    mapping = nullptr;
+    handle = -1;
+    bytes = 0;
+}
@@ -1,4 +1,6 @@
 #include "mirror.hpp"
+#include "gaussian_beam.hpp"
+#include "ray_bundle.hpp"
 
 Mirror::Mirror(const vec3 &position, const vec3 &orientation, const std::string name, double size, double reflectivity, std::complex<double> refractive_index)
     : OpticalElement(position, orientation, name),
@@ -35,7 +37,35 @@ void Mirror::interact_ray(ray &beamlet)
     beamlet.reflect(getOrientation());
 }
 
+void Mirror::hit_bundle(const RayBundle &rays, double *t)
+{
+    rays.intersectPlane(getPosition(), getOrientation(), t);
+    rays.clipSquare(getPosition(), v, u, size / 2.0, t);
+}
+
+void Mirror::interact_bundle(RayBundle &rays, const std::vector<int> &indices)
+{
+    const int n = (int)indices.size();
+    const vec3 normal = getOrientation();
+    const double nx = normal.x(), ny = normal.y(), nz = normal.z();
+
+#pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; k++)
+    {
+        int i = indices[k];
+        double proj = 2.0 * (rays.dx[i] * nx + rays.dy[i] * ny + rays.dz[i] * nz);
+        rays.dx[i] -= proj * nx;
+        rays.dy[i] -= proj * ny;
+        rays.dz[i] -= proj * nz;
+    }
+}
+
 void Mirror::interact_wavefront(WaveFront &A)
 {
     A.reflect(getOrientation());
+}
+
+bool Mirror::interact_beam(GaussianBeam &beam)
+{
+    return beam.reflect(getOrientation());
 }
\ No newline at end of file
@@ -0,0 +1,267 @@
+#include "net.hpp"
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET native_socket;
+typedef int io_size;
+static void closeNative(native_socket s) { closesocket(s); }
+static const int SHUTDOWN_BOTH = SD_BOTH;
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+typedef int native_socket;
+typedef size_t io_size;
+static void closeNative(native_socket s) { ::close(s); }
+static const int SHUTDOWN_BOTH = SHUT_RDWR;
+#endif
+
+bool NetStartup()
+{
+#ifdef _WIN32
+    static bool started = false;
+    if (!started)
+    {
+        WSADATA data;
+        started = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }
+    return started;
+#else
+    return true;
+#endif
+}
+
+Connection::Connection(Connection &&other) noexcept
+    : handle(other.handle), pending(std::move(other.pending)), timed(other.timed), deadline(other.deadline)
+{
+    other.handle = -1;
+}
+
+Connection &Connection::operator=(Connection &&other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        handle = other.handle;
+        pending = std::move(other.pending);
+        timed = other.timed;
+        deadline = other.deadline;
+        other.handle = -1;
+    }
+    return *this;
+}
+
+Connection Connection::connect(const std::string &host, int port)
+{
+    if (!NetStartup())
+        return Connection();
+
+    addrinfo hints = {}, *found = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0)
+        return Connection();
+
+    Connection result;
+    for (addrinfo *a = found; a; a = a->ai_next)
+    {
+        native_socket s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if ((long long)s == -1)
+            continue;
+        if (::connect(s, a->ai_addr, (int)a->ai_addrlen) == 0)
+        {
+            int on = 1;
+            setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on)); // Replies are small lines followed by bulk data
+            result = Connection((long long)s);
+            break;
+        }
+        closeNative(s);
+    }
+    freeaddrinfo(found);
+    return result;
+}
+
+void Connection::close()
+{
+    if (handle == -1)
+        return;
+    closeNative((native_socket)handle);
+    handle = -1;
+    pending.clear();
+}
+
+void Connection::shutdown()
+{
+    if (handle != -1)
+        ::shutdown((native_socket)handle, SHUTDOWN_BOTH);
+}
+
+bool Connection::sendAll(const void *data, size_t bytes)
+{
+    const char *p = (const char *)data;
+    while (bytes > 0 && handle != -1)
+    {
+        io_size chunk = (io_size)(bytes < (1u << 30) ? bytes : (1u << 30));
+#ifdef MSG_NOSIGNAL
+        long long sent = send((native_socket)handle, p, chunk, MSG_NOSIGNAL); // A vanished peer is an error, not SIGPIPE
+#else
+        long long sent = send((native_socket)handle, p, chunk, 0);
+#endif
+        if (sent <= 0)
+            return false;
+        p += sent;
+        bytes -= (size_t)sent;
+    }
+    return bytes == 0;
+}
+
+bool Connection::sendLine(const std::string &line)
+{
+    std::string text = line + "\n";
+    return sendAll(text.data(), text.size());
+}
+
+void Connection::setReadTimeout(int milliseconds)
+{
+    timed = milliseconds > 0;
+    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    if (!timed && handle != -1)
+    {
+#ifdef _WIN32
+        DWORD none = 0;
+#else
+        timeval none = {};
+#endif
+        setsockopt((native_socket)handle, SOL_SOCKET, SO_RCVTIMEO, (const char *)&none, sizeof(none));
+    }
+}
+
+// The socket's receive timeout is set to what is left of the deadline before every call, so a
+// peer that sends a byte at a time still cannot hold the reader past it
+long long Connection::receive(char *data, size_t bytes)
+{
+    if (handle == -1)
+        return -1;
+    if (timed)
+    {
+        long long left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0)
+            return -1;
+#ifdef _WIN32
+        DWORD wait = (DWORD)left;
+#else
+        timeval wait = {};
+        wait.tv_sec = (time_t)(left / 1000);
+        wait.tv_usec = (suseconds_t)(left % 1000 * 1000);
+#endif
+        setsockopt((native_socket)handle, SOL_SOCKET, SO_RCVTIMEO, (const char *)&wait, sizeof(wait));
+    }
+    io_size chunk = (io_size)(bytes < (1u << 30) ? bytes : (1u << 30));
+    return recv((native_socket)handle, data, chunk, 0);
+}
+
+bool Connection::readLine(std::string &line)
+{
+    char buf[4096];
+    while (true)
+    {
+        size_t end = pending.find('\n');
+        if (end != std::string::npos)
+        {
+            line = pending.substr(0, end);
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            pending.erase(0, end + 1);
+            return true;
+        }
+        long long got = receive(buf, sizeof(buf));
+        if (got <= 0)
+            return false;
+        pending.append(buf, (size_t)got);
+    }
+}
+
+bool Connection::readExactly(void *data, size_t bytes)
+{
+    char *p = (char *)data;
+    size_t buffered = pending.size() < bytes ? pending.size() : bytes;
+    std::memcpy(p, pending.data(), buffered);
+    pending.erase(0, buffered);
+    p += buffered;
+    bytes -= buffered;
+
+    while (bytes > 0)
+    {
+        long long got = receive(p, bytes);
+        if (got <= 0)
+            return false;
+        p += got;
+        bytes -= (size_t)got;
+    }
+    return true;
+}
+
+bool Listener::listen(int port, bool loopbackOnly)
+{
+    if (!NetStartup())
+        return false;
+    close();
+
+    native_socket s = socket(AF_INET, SOCK_STREAM, 0);
+    if ((long long)s == -1)
+        return false;
+    int on = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)port);
+    addr.sin_addr.s_addr = htonl(loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+    if (bind(s, (sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(s, 16) != 0)
+    {
+        closeNative(s);
+        return false;
+    }
+    handle = (long long)s;
+    return true;
+}
+
+int Listener::getPort() const
+{
+    if (handle == -1)
+        return 0;
+    sockaddr_in addr = {};
+    socklen_t len = sizeof(addr);
+    if (getsockname((native_socket)handle, (sockaddr *)&addr, &len) != 0)
+        return 0;
+    return ntohs(addr.sin_port);
+}
+
+Connection Listener::accept()
+{
+    if (handle == -1)
+        return Connection();
+    native_socket s = ::accept((native_socket)handle, nullptr, nullptr);
+    if ((long long)s == -1)
+        return Connection();
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+    return Connection((long long)s);
+}
+
+// Shutting the socket down first wakes a thread blocked in accept()
+void Listener::close()
+{
+    if (handle == -1)
+        return;
+    shutdown((native_socket)handle, SHUTDOWN_BOTH);
+    closeNative((native_socket)handle);
+    handle = -1;
+}
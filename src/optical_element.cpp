@@ -1,4 +1,5 @@
 #include "optical_element.hpp"
+#include "ray_bundle.hpp"
 
 // Constructor
 OpticalElement::OpticalElement(const vec3 &pos, const vec3 &orient, const std::string &n)
@@ -30,10 +31,47 @@ void OpticalElement::setPosition(vec3 pos)
 
 void OpticalElement::setOrientation(vec3 o)
 {
-    orientation = o;
+    orientation = unit_vector(o); // As in the constructor; the local frame and getBounds assume a unit normal
     init_local_frame();
 }
 
+// Ray-by-ray fallbacks; the elements override them with kernels over the whole bundle
+void OpticalElement::hit_bundle(const RayBundle &rays, double *t)
+{
+    for (size_t i = 0; i < rays.size(); i++)
+        t[i] = rays.alive[i] ? hit(rays.get(i)) : -999.0;
+}
+
+void OpticalElement::interact_bundle(RayBundle &rays, const std::vector<int> &indices)
+{
+    for (int i : indices)
+    {
+        ray beamlet = rays.get(i);
+        interact_ray(beamlet);
+        rays.set(i, beamlet);
+        if (!beamlet.isAlive())
+            rays.alive[i] = 0;
+    }
+}
+
+// A disc of radius r with unit normal n reaches r * sqrt(1 - n_i^2) from its centre along axis i
+void OpticalElement::getBounds(vec3 &lo, vec3 &hi) const
+{
+    const double r = apertureRadius();
+    const vec3 n = unit_vector(orientation);
+    vec3 extent(r * std::sqrt(max(0.0, 1.0 - sq(n.x()))),
+                r * std::sqrt(max(0.0, 1.0 - sq(n.y()))),
+                r * std::sqrt(max(0.0, 1.0 - sq(n.z()))));
+    lo = position - extent;
+    hi = position + extent;
+}
+
+void OpticalElement::receive_wavefront(WaveFront &A, double distance)
+{
+    A.propagate(distance);
+    interact_wavefront(A);
+}
+
 void OpticalElement::init_local_frame()
 {
     w = orientation;
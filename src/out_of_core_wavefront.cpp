@@ -0,0 +1,225 @@
+#include "out_of_core_wavefront.hpp"
+#include <algorithm>
+#include <cmath>
+#include "buffer_pool.hpp"
+#include "fft_plans.hpp"
+#include "simulation_engine.hpp"
+#include "utils.hpp"
+
+OutOfCoreWaveFront::OutOfCoreWaveFront(WaveFront &shape, int samples, const std::string &scratchDir, size_t budgetBytes)
+    : normal(shape.getNormal()), u(shape.u), v(shape.v), w(shape.w)
+{
+    wavelength = shape.getWavelength();
+    N = nextFastFFTSize(samples > 0 ? samples : shape.N);
+    pixel_size = shape.getSize() / N;
+    n = nextFastFFTSize((int)std::ceil(N * shape.getGuardFactor()));
+
+    // The work buffer holds block whole rows or block whole columns; n is a product of small
+    // primes, so a divisor close to what the budget allows is never far off
+    const size_t fit = budgetBytes / (sizeof(fftw_complex) * (size_t)n);
+    block = (int)min(max(fit, (size_t)1), (size_t)n);
+    while (n % block != 0)
+        block--;
+
+    if (Ex.create(scratchDir, gridBytes()))
+        Ey.create(scratchDir, gridBytes());
+}
+
+FieldSlab OutOfCoreWaveFront::slab(int first, int count)
+{
+    FieldSlab slab;
+    slab.n = n;
+    slab.centre = n / 2; // The field's own centre, N / 2 + pad
+    slab.first = first;
+    slab.pixel_size = pixel_size;
+    slab.wavelength = wavelength;
+    slab.origin = normal.pos();
+    slab.u = u;
+    slab.v = v;
+    for (int r = first; r < first + count; r++)
+    {
+        slab.ex.push_back(grid(Ex) + (size_t)r * n);
+        slab.ey.push_back(grid(Ey) + (size_t)r * n);
+    }
+    return slab;
+}
+
+// The files start out zero-filled, so only the field's own N x N samples are written
+void OutOfCoreWaveFront::initialize(const WaveFront &shape)
+{
+    const int pad = (n - N) / 2;
+    std::complex<double> *ex = grid(Ex), *ey = grid(Ey);
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++)
+    {
+        double y = (i - N / 2) * pixel_size;
+        size_t row = (size_t)(pad + i) * n + pad;
+        for (int j = 0; j < N; j++)
+            shape.fieldAt((j - N / 2) * pixel_size, y, ex[row + j], ey[row + j]);
+    }
+}
+
+void OutOfCoreWaveFront::transformRows(MappedFile &file, int direction)
+{
+    const int pad = (n - N) / 2;
+    const double norm = 1.0 / (double(n) * n);
+    std::complex<double> *g = grid(file);
+
+    PooledBuffer work((size_t)block * n);
+    std::complex<double> *buf = work.data();
+    fftw_plan plan = FftPlans::instance().get(1, n, block, 1, n, direction, true);
+
+    for (int first = 0; first < n; first += block)
+    {
+        std::complex<double> *rows = g + (size_t)first * n;
+        const bool guard = first + block <= pad || first >= pad + N; // No row of the field in this block
+        if (direction == FFTW_FORWARD)
+        {
+            if (guard)
+                continue; // Zero, and so is its transform
+
+            // The (-1)^(i+j) factors move the zero frequency to the grid centre, as embedCentred does
+#pragma omp parallel for schedule(static)
+            for (int r = 0; r < block; r++)
+                for (int j = 0; j < n; j++)
+                    buf[(size_t)r * n + j] = ((first + r + j) & 1) ? -rows[(size_t)r * n + j] : rows[(size_t)r * n + j];
+            fftw_execute_dft(plan, work.fftw(), work.fftw());
+            std::copy(buf, buf + (size_t)block * n, rows);
+        }
+        else
+        {
+            if (guard)
+            {
+                std::fill(rows, rows + (size_t)block * n, 0.0);
+                continue;
+            }
+            std::copy(rows, rows + (size_t)block * n, buf);
+            fftw_execute_dft(plan, work.fftw(), work.fftw());
+
+            // Undoes the centring and crops to the field, like extractCentred followed by the next embedCentred
+#pragma omp parallel for schedule(static)
+            for (int r = 0; r < block; r++)
+            {
+                const int i = first + r;
+                const bool inside = i >= pad && i < pad + N;
+                for (int j = 0; j < n; j++)
+                {
+                    double s = !inside || j < pad || j >= pad + N ? 0.0 : ((i + j) & 1) ? -norm : norm;
+                    rows[(size_t)r * n + j] = buf[(size_t)r * n + j] * s;
+                }
+            }
+        }
+    }
+}
+
+// Pencils of block columns: each row contributes one contiguous run of block values
+void OutOfCoreWaveFront::filterColumns(MappedFile &file, const TransferFunction &H)
+{
+    std::complex<double> *g = grid(file);
+
+    PooledBuffer work((size_t)n * block);
+    std::complex<double> *buf = work.data();
+    fftw_plan forward = FftPlans::instance().get(1, n, block, block, 1, FFTW_FORWARD, true);
+    fftw_plan inverse = FftPlans::instance().get(1, n, block, block, 1, FFTW_BACKWARD, true);
+
+    for (int first = 0; first < n; first += block)
+    {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++)
+            std::copy(g + (size_t)i * n + first, g + (size_t)i * n + first + block, buf + (size_t)i * block);
+
+        fftw_execute_dft(forward, work.fftw(), work.fftw());
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++)
+            for (int c = 0; c < block; c++)
+                buf[(size_t)i * block + c] *= H(i, first + c);
+        fftw_execute_dft(inverse, work.fftw(), work.fftw());
+
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++)
+            std::copy(buf + (size_t)i * block, buf + (size_t)(i + 1) * block, g + (size_t)i * n + first);
+    }
+}
+
+void OutOfCoreWaveFront::propagate(double z, bool exact)
+{
+    if (z == 0.0)
+        return;
+
+    TransferFunction H(z, wavelength, pixel_size, n, exact);
+    for (MappedFile *file : {&Ex, &Ey})
+    {
+        transformRows(*file, FFTW_FORWARD);
+        filterColumns(*file, H);
+        transformRows(*file, FFTW_BACKWARD);
+    }
+    normal.propagate(z);
+}
+
+// Masks multiply, so the guard rows stay zero and are left alone
+bool OutOfCoreWaveFront::interact(OpticalElement &element)
+{
+    const int pad = (n - N) / 2;
+    for (int first = pad / block * block; first < pad + N; first += block)
+    {
+        FieldSlab rows = slab(first, block);
+        if (!element.interact_slab(rows))
+            return false;
+    }
+    return true;
+}
+
+bool OutOfCoreWaveFront::receive(Camera &camera)
+{
+    if (std::abs(dot(camera.getSensedWaveFront().w, w)) < 1.0 - 1e-9)
+        return false; // Needs the rotation of the whole angular spectrum
+
+    const FieldSlab field = slab(0, 0);
+    int i0, i1, j0, j1;
+    if (!camera.window(field, i0, i1, j0, j1))
+        return true; // The sensor is off the grid
+
+    // Blocks of rows go from the mapping onto the sensor, so only the window's pages are read
+    for (int first = i0; first <= i1; first += block)
+        camera.receiveSlab(slab(first, min(block, i1 + 1 - first)));
+    return true;
+}
+
+bool OutOfCoreSimulation::Run(Scene &scene, const SimulationSettings &settings, int N, const std::string &scratchDir, size_t budgetBytes, std::string &error)
+{
+    for (auto &path : SimulationEngine::FindPaths(scene))
+    {
+        if (!SimulationEngine::CheckFixedGrid(settings, path, "out-of-core", error))
+            return false;
+        WaveFront &shape = path.source->E;
+        const bool exact = shape.getPropagationMethod() != PropagationMethod::FRESNEL;
+
+        OutOfCoreWaveFront field(shape, N, scratchDir, budgetBytes);
+        if (!field.isOpen())
+        {
+            error = "cannot create two " + std::to_string(field.gridBytes() >> 20) + " MiB scratch files in " + (scratchDir.empty() ? std::string("the temporary directory") : scratchDir);
+            return false;
+        }
+        field.initialize(shape);
+        for (auto element : path.Elements)
+        {
+            double dist = element->hit(field.getNormal());
+            if (dist == -999.0)
+                continue;
+            if (!SimulationEngine::CheckFixedGridStep(path, *element, dist, field.fresnelNumber(dist), "out-of-core", error))
+                return false;
+
+            field.propagate(dist, exact);
+            Camera *camera = dynamic_cast<Camera *>(element);
+            if (camera ? !field.receive(*camera) : !field.interact(*element))
+            {
+                error = element->getName() + (camera ? " is tilted against the beam" : " needs the whole field") + ", which out-of-core runs do not support";
+                return false;
+            }
+            if (camera)
+                break; // The sensor absorbs the beam
+        }
+    }
+    return true;
+}
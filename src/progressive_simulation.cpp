@@ -0,0 +1,157 @@
+#include "progressive_simulation.hpp"
+#include "utils.hpp"
+
+constexpr int ProgressiveSimulation::LEVELS[];
+
+ProgressiveSimulation::ProgressiveSimulation() : worker(&ProgressiveSimulation::Work, this) {}
+
+ProgressiveSimulation::~ProgressiveSimulation()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+        cancel = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void ProgressiveSimulation::Request(const Scene &scene, const SimulationSettings &settings)
+{
+    auto snapshot = std::make_unique<Scene>(scene.Snapshot());
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pending = std::move(snapshot);
+        pendingSettings = settings;
+        readyDivisor = 0; // Anything finished so far belongs to the old state of the scene
+        cancel = true;
+    }
+    wake.notify_one();
+}
+
+void ProgressiveSimulation::Stop()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    pending.reset();
+    readyDivisor = 0;
+    cancel = true;
+    idle.wait(guard, [this]() { return !busy; });
+}
+
+bool ProgressiveSimulation::Collect(Scene &scene)
+{
+    std::vector<std::pair<int, WaveFront>> fields;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (readyDivisor == 0)
+            return false;
+        fields.swap(readyFields);
+        shownDivisor = readyDivisor;
+        readyDivisor = 0;
+    }
+
+    for (auto &field : fields)
+    {
+        SceneObject *obj = scene.Find(field.first);
+        if (obj && obj->kind == ElementKind::CAMERA)
+            static_cast<Camera *>(obj->element.get())->getSensedWaveFront() = std::move(field.second);
+    }
+    return true;
+}
+
+bool ProgressiveSimulation::isRefining()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return busy || pending != nullptr;
+}
+
+void ProgressiveSimulation::Work()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+        wake.wait(guard, [this]() { return quit || pending; });
+        if (quit)
+            return;
+
+        std::unique_ptr<Scene> base = std::move(pending);
+        SimulationSettings settings = pendingSettings;
+        cancel = false;
+        busy = true;
+
+        guard.unlock();
+        Refine(*base, settings);
+        base.reset(); // Releases the snapshot's grids before reporting idle
+        guard.lock();
+
+        busy = false;
+        idle.notify_all();
+    }
+}
+
+std::unique_ptr<Scene> ProgressiveSimulation::Level(const Scene &base, int divisor, std::vector<int> &grids)
+{
+    auto level = std::make_unique<Scene>(base.Snapshot());
+    grids.clear();
+    for (auto &obj : level->GetObjects())
+    {
+        if (obj->source)
+        {
+            WaveFront &E = obj->source->E;
+            if (divisor > 1)
+                E.setGrid(E.getSize(), E.getSize() / max(64, E.N / divisor)); // Coarser source grids stop resolving the beam
+            grids.push_back(E.N);
+        }
+        if (obj->kind == ElementKind::CAMERA)
+        {
+            Camera *cam = static_cast<Camera *>(obj->element.get());
+            const int resolution = cam->getResolution() / divisor; // Evaluated once: max is a macro
+            cam->setResolution(max(16, resolution));
+            grids.push_back(cam->getResolution());
+        }
+    }
+    return level;
+}
+
+void ProgressiveSimulation::Refine(const Scene &base, const SimulationSettings &settings)
+{
+    SimulationSettings levelSettings = settings;
+    levelSettings.cancel = &cancel;
+
+    const int count = sizeof(LEVELS) / sizeof(LEVELS[0]);
+    std::vector<int> grids, nextGrids;
+    std::unique_ptr<Scene> level = Level(base, LEVELS[0], grids);
+    for (int k = 0; k < count; k++)
+    {
+        // Small sources bottom out at 64 samples and small cameras at 16 pixels, so neighbouring
+        // levels can come out identical: only the finer of the two is simulated
+        std::unique_ptr<Scene> next;
+        if (k + 1 < count)
+        {
+            next = Level(base, LEVELS[k + 1], nextGrids);
+            if (nextGrids == grids)
+            {
+                level = std::move(next);
+                continue;
+            }
+        }
+
+        SimulationEngine::Run(*level, levelSettings);
+        if (cancel)
+            return;
+
+        std::vector<std::pair<int, WaveFront>> fields;
+        for (auto obj : level->GetObjectsOfKind(ElementKind::CAMERA))
+            fields.emplace_back(obj->id, std::move(static_cast<Camera *>(obj->element.get())->getSensedWaveFront()));
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (cancel)
+                return;
+            readyFields = std::move(fields);
+            readyDivisor = LEVELS[k];
+        }
+        level = std::move(next);
+        grids.swap(nextGrids);
+    }
+}
@@ -0,0 +1,112 @@
+#include "ray_bundle.hpp"
+#include <cmath>
+
+void RayBundle::reserve(size_t n)
+{
+    px.reserve(n);
+    py.reserve(n);
+    pz.reserve(n);
+    dx.reserve(n);
+    dy.reserve(n);
+    dz.reserve(n);
+    alive.reserve(n);
+}
+
+void RayBundle::add(const point3 &pos, const vec3 &dir)
+{
+    vec3 d = unit_vector(dir);
+    px.push_back(pos.x());
+    py.push_back(pos.y());
+    pz.push_back(pos.z());
+    dx.push_back(d.x());
+    dy.push_back(d.y());
+    dz.push_back(d.z());
+    alive.push_back(1);
+}
+
+ray RayBundle::get(size_t i) const
+{
+    return ray(point3(px[i], py[i], pz[i]), vec3(dx[i], dy[i], dz[i]));
+}
+
+void RayBundle::set(size_t i, const ray &r)
+{
+    px[i] = r.pos().x();
+    py[i] = r.pos().y();
+    pz[i] = r.pos().z();
+    dx[i] = r.dir().x();
+    dy[i] = r.dir().y();
+    dz[i] = r.dir().z();
+}
+
+// Same rules as the elements' hit(): rays (nearly) parallel to the plane or reaching it within
+// 1e-6 of their origin miss
+void RayBundle::intersectPlane(const point3 &point, const vec3 &normal, double *t) const
+{
+    const int n = (int)size();
+    const double nx = normal.x(), ny = normal.y(), nz = normal.z();
+    const double offset = dot(point, normal);
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++)
+    {
+        double denom = dx[i] * nx + dy[i] * ny + dz[i] * nz;
+        double dist = (offset - (px[i] * nx + py[i] * ny + pz[i] * nz)) / denom;
+        t[i] = (alive[i] && std::abs(denom) >= 1e-6 && dist >= 1e-6) ? dist : -999.0;
+    }
+}
+
+void RayBundle::clipDisc(const point3 &centre, double radius, double *t) const
+{
+    const int n = (int)size();
+    const double cx = centre.x(), cy = centre.y(), cz = centre.z();
+    const double r2 = radius * radius;
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++)
+    {
+        if (t[i] == -999.0)
+            continue;
+        double hx = px[i] + dx[i] * t[i] - cx;
+        double hy = py[i] + dy[i] * t[i] - cy;
+        double hz = pz[i] + dz[i] * t[i] - cz;
+        if (hx * hx + hy * hy + hz * hz > r2)
+            t[i] = -999.0;
+    }
+}
+
+void RayBundle::clipSquare(const point3 &centre, const vec3 &a, const vec3 &b, double half_size, double *t) const
+{
+    const int n = (int)size();
+    const double cx = centre.x(), cy = centre.y(), cz = centre.z();
+    const double ax = a.x(), ay = a.y(), az = a.z();
+    const double bx = b.x(), by = b.y(), bz = b.z();
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++)
+    {
+        if (t[i] == -999.0)
+            continue;
+        double hx = px[i] + dx[i] * t[i] - cx;
+        double hy = py[i] + dy[i] * t[i] - cy;
+        double hz = pz[i] + dz[i] * t[i] - cz;
+        double x = hx * ax + hy * ay + hz * az;
+        double y = hx * bx + hy * by + hz * bz;
+        if (std::abs(x) > half_size || std::abs(y) > half_size)
+            t[i] = -999.0;
+    }
+}
+
+void RayBundle::propagate(const std::vector<int> &indices, const double *t)
+{
+    const int n = (int)indices.size();
+
+#pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; k++)
+    {
+        int i = indices[k];
+        px[i] += dx[i] * t[i];
+        py[i] += dy[i] * t[i];
+        pz[i] += dz[i] * t[i];
+    }
+}
@@ -0,0 +1,116 @@
+#include "ray_tracer.hpp"
+#include "utils.hpp"
+#include <cmath>
+
+size_t RayTracer::Trace(Scene &scene, const RayTraceSettings &settings)
+{
+    const ElementBVH &bvh = scene.GetElementBVH();
+    std::vector<OpticalElement *> Elements(bvh.size());
+    for (size_t k = 0; k < bvh.size(); k++)
+        Elements[k] = bvh.element((int)k);
+    ElementStore store;
+    store.build(Elements);
+    for (auto cam : scene.GetSensors())
+        cam->clearSpots();
+
+    size_t launched = 0;
+    for (auto Src : scene.GetActiveSource())
+    {
+        RayBundle rays = Emit(*Src, settings.raysPerSource);
+        launched += rays.size();
+        Propagate(rays, bvh, store, settings.maxBounces);
+    }
+    return launched;
+}
+
+// Parallel rays on a square grid filling the beam's cross-section: the 1/e^2 radius of the
+// fundamental, widened with the mode order, or the whole grid for plane waves
+RayBundle RayTracer::Emit(Source &src, int count)
+{
+    double radius = src.getBeamWaist();
+    switch (src.getFieldType())
+    {
+    case FieldType::PLANE:
+        radius = src.E.getSize() / 2.0;
+        break;
+    case FieldType::LG:
+        radius *= std::sqrt(2.0 * src.getP() + std::abs(src.getL()) + 1.0);
+        break;
+    case FieldType::HG:
+        radius *= std::sqrt(std::abs(src.getL()) + src.getP() + 1.0);
+        break;
+    default:
+        break;
+    }
+
+    const double pitch = radius * std::sqrt(PI / max(count, 1));
+    const int half = (int)std::floor(radius / pitch);
+    const vec3 dir = src.getOrientation();
+
+    RayBundle rays;
+    rays.reserve((size_t)(2 * half + 1) * (2 * half + 1));
+    for (int i = -half; i <= half; i++)
+        for (int j = -half; j <= half; j++)
+        {
+            double x = j * pitch, y = i * pitch;
+            if (x * x + y * y <= radius * radius)
+                rays.add(src.getPosition() + x * src.E.v + y * src.E.u, dir);
+        }
+    return rays;
+}
+
+// Non-sequential tracing of the whole bundle: each bounce finds every ray's nearest hit
+// (skipping the element it just left), moves the rays there and lets each element act on the
+// rays that reached it. Rays that hit nothing leave the scene. Small scenes test every record
+// of the store per ray; larger ones walk the BVH so only nearby elements are tested
+void RayTracer::Propagate(RayBundle &rays, const ElementBVH &bvh, const ElementStore &store, int maxBounces)
+{
+    const int n = (int)rays.size();
+    const int count = (int)bvh.size();
+    std::vector<double> tmin(n);
+    std::vector<int> target(n), last(n, -1);
+    std::vector<std::vector<int>> arrivals(count);
+
+    for (int bounce = 0; bounce < maxBounces; bounce++)
+    {
+        std::fill(tmin.begin(), tmin.end(), INF);
+        std::fill(target.begin(), target.end(), -1);
+
+        if (count > BVH_MIN_ELEMENTS)
+        {
+#pragma omp parallel for schedule(dynamic, 256)
+            for (int i = 0; i < n; i++)
+                if (rays.alive[i])
+                    target[i] = bvh.closestHit(rays.get(i), tmin[i], last[i]);
+        }
+        else
+            store.closestHits(rays, last.data(), target.data(), tmin.data());
+
+        bool any = false;
+        for (auto &list : arrivals)
+            list.clear();
+        for (int i = 0; i < n; i++)
+        {
+            if (!rays.alive[i])
+                continue;
+            if (target[i] < 0)
+            {
+                rays.alive[i] = 0;
+                continue;
+            }
+            arrivals[target[i]].push_back(i);
+            any = true;
+        }
+        if (!any)
+            break;
+
+        for (int e = 0; e < count; e++)
+        {
+            if (arrivals[e].empty())
+                continue;
+            rays.propagate(arrivals[e], tmin.data());
+            store.interact(e, rays, arrivals[e]);
+        }
+        last.swap(target);
+    }
+}
@@ -0,0 +1,358 @@
+#include "serialization.hpp"
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+static const char *FIELD_NAMES[] = {"plane", "gaussian", "lg", "hg"}; // FieldType order
+
+// Upper bounds on the keys that size the grids and the work of a run, so a description cannot
+// ask for more memory or time than any machine has
+static const int MAX_RESOLUTION = 8192;      // Sensor pixels per side
+static const int MAX_SPECTRAL_SAMPLES = 256; // Wavelengths per source, one propagation each
+static const double MAX_GUARD = 4.0;         // Padding factor of the source grid's FFTs
+static const int MAX_MODE_ORDER = 100;       // Indices l and p of LG and HG beams
+static const double MAX_DROPPED_POWER = 0.2; // Share of a partially coherent source's power its retained modes may leave out
+
+// key=value pairs of one line, with typed access that records the first malformed value
+class Options
+{
+private:
+    std::map<std::string, std::string> values;
+
+public:
+    std::string bad; // First key whose value did not parse
+
+    bool parse(std::istringstream &tokens, std::string &error)
+    {
+        std::string token;
+        while (tokens >> token)
+        {
+            size_t eq = token.find('=');
+            if (eq == std::string::npos || eq == 0)
+            {
+                error = "expected key=value, got '" + token + "'";
+                return false;
+            }
+            values[token.substr(0, eq)] = token.substr(eq + 1);
+        }
+        return true;
+    }
+
+    bool has(const std::string &key) const { return values.count(key) != 0; }
+
+    double number(const std::string &key, double fallback)
+    {
+        auto found = values.find(key);
+        if (found == values.end())
+            return fallback;
+        std::istringstream in(found->second);
+        double x;
+        if (!(in >> x) || !in.eof())
+        {
+            if (bad.empty())
+                bad = key;
+            return fallback;
+        }
+        values.erase(found);
+        return x;
+    }
+
+    std::string text(const std::string &key, const std::string &fallback)
+    {
+        auto found = values.find(key);
+        if (found == values.end())
+            return fallback;
+        std::string s = found->second;
+        values.erase(found);
+        return s;
+    }
+
+    // Integer value of magnitude at most limit; anything else (including what does not fit an
+    // int) is reported through error, naming the key
+    int count(const std::string &key, int fallback, int limit, std::string &error)
+    {
+        double x = number(key, fallback);
+        if (!(std::abs(x) <= limit))
+        {
+            if (error.empty())
+                error = "'" + key + "' out of range (at most " + std::to_string(limit) + ")";
+            return fallback;
+        }
+        return (int)x;
+    }
+
+    std::string leftover() const { return values.empty() ? std::string() : values.begin()->first; } // A key no reader asked for
+};
+
+static void applySource(Source &src, Options &opt, std::string &error)
+{
+    std::string field = opt.text("field", "");
+    if (!field.empty())
+    {
+        int type = -1;
+        for (int k = 0; k < 4; k++)
+            if (field == FIELD_NAMES[k])
+                type = k;
+        if (type < 0)
+        {
+            error = "unknown field type '" + field + "'";
+            return;
+        }
+        src.setFieldType((FieldType)type);
+    }
+    src.setWavelength(opt.number("wavelength", src.getWavelength())); // Before the bandwidth, which is clamped to it
+    src.setBeamWaist(opt.number("waist", src.getBeamWaist()));
+    int l = opt.count("l", src.getL(), MAX_MODE_ORDER, error);
+    src.setBeamMode(l, opt.count("p", src.getP(), MAX_MODE_ORDER, error));
+    src.setPsi(opt.number("psi", src.getPsi()));
+    src.setDelta(opt.number("delta", src.getDelta()));
+    double guard = opt.number("guard", src.getGuardFactor());
+    if (!(guard <= MAX_GUARD))
+        error = "'guard' out of range (at most " + std::to_string((int)MAX_GUARD) + ")";
+    else
+        src.setGuardFactor(guard);
+    src.setBandwidth(opt.number("bandwidth", src.getBandwidth()));
+    src.setSpectralSamples(opt.count("samples", src.getSpectralSamples(), MAX_SPECTRAL_SAMPLES, error)); // Clamped up to 1
+    src.setCoherenceWidth(opt.number("coherence", src.getCoherenceWidth()));
+    src.setModeThreshold(opt.number("threshold", src.getModeThreshold()));
+    src.setMaxModes(opt.count("modes", src.getMaxModes(), INT_MAX, error)); // Clamped to [1, 1035]
+
+    // The retained modes are renormalized, so a truncation that drops much of the power would
+    // quietly simulate a far more coherent beam
+    std::vector<int> m, n;
+    std::vector<double> weights;
+    double waist, dropped;
+    src.sampleModes(m, n, weights, waist, dropped);
+    if (error.empty() && dropped > MAX_DROPPED_POWER)
+        error = "the " + std::to_string(m.size()) + " coherent modes kept leave out " + std::to_string((int)std::lround(100.0 * dropped)) +
+                "% of the power; raise 'modes', lower 'threshold' or widen 'coherence'";
+}
+
+template <typename Lens>
+static void applyLens(Lens &lens, Options &opt)
+{
+    lens.setRadius(opt.number("diameter", 2.0 * lens.getRadius()) / 2.0);
+    lens.setFocalLength(opt.number("focal", lens.getFocalLength()));
+    lens.setRefractiveIndex(opt.number("n", lens.getRefractiveIndex()));
+}
+
+static void applyElement(SceneObject &obj, Options &opt, std::string &error)
+{
+    switch (obj.kind)
+    {
+    case ElementKind::CAMERA:
+    {
+        Camera &cam = static_cast<Camera &>(*obj.element);
+        cam.setSize(opt.number("size", cam.getSize())); // Resets the region of interest
+        int resolution = opt.count("resolution", cam.getResolution(), MAX_RESOLUTION, error); // Read once: min and max are macros
+        cam.setResolution(max(16, resolution));
+        if (opt.has("roi") || opt.has("roix") || opt.has("roiy"))
+        {
+            double roi = opt.number("roi", cam.getROISize());
+            cam.setROI(max(1e-6, roi), opt.number("roix", cam.getROIX()), opt.number("roiy", cam.getROIY()));
+        }
+        cam.setZoomPropagation(opt.number("zoom", cam.getZoomPropagation()) != 0.0);
+        break;
+    }
+    case ElementKind::MIRROR:
+    {
+        Mirror &mirror = static_cast<Mirror &>(*obj.element);
+        mirror.setSize(opt.number("size", mirror.getSize()));
+        double reflectivity = opt.number("reflectivity", mirror.getReflectivity());
+        mirror.setReflectivity(min(max(reflectivity, 0.0), 1.0));
+        double n = opt.number("n", mirror.getRefractiveIndex().real());
+        double k = opt.number("k", mirror.getRefractiveIndex().imag());
+        mirror.setRefractiveIndex(std::complex<double>(n, max(0.0, k)));
+        break;
+    }
+    case ElementKind::CONVEX_LENS:
+        applyLens(static_cast<ConvexLens &>(*obj.element), opt);
+        break;
+    case ElementKind::CONCAVE_LENS:
+        applyLens(static_cast<ConcaveLens &>(*obj.element), opt);
+        break;
+    case ElementKind::IRIS:
+    {
+        Iris &iris = static_cast<Iris &>(*obj.element);
+        iris.setSize(opt.number("size", iris.getSize())); // Before the radius, which is clamped to it
+        iris.setRadius(opt.number("radius", iris.getRadius()));
+        break;
+    }
+    case ElementKind::SLIT:
+    {
+        Slit &slit = static_cast<Slit &>(*obj.element);
+        slit.setSize(opt.number("size", slit.getSize()));
+        slit.setWidth(opt.number("width", slit.getWidth()));
+        slit.setHeight(opt.number("height", slit.getHeight()));
+        int count = (int)opt.number("count", slit.getNumSlits());
+        slit.setNumSlits(max(1, count));
+        slit.setSeparation(opt.number("separation", slit.getSeparation()));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+bool ReadScene(std::istream &in, Scene &scene, SimulationSettings &settings, std::string &error)
+{
+    std::string line;
+    int number = 0;
+    error.clear();
+    while (std::getline(in, line))
+    {
+        number++;
+        std::istringstream tokens(line);
+        std::string type;
+        if (!(tokens >> type) || type[0] == '#')
+            continue;
+
+        auto fail = [&](const std::string &message) {
+            error = "line " + std::to_string(number) + ": " + message;
+            return false;
+        };
+
+        Options opt;
+        if (type == "Settings")
+        {
+            if (!opt.parse(tokens, error))
+                return fail(error);
+            settings.adaptiveSampling = opt.number("adaptive", settings.adaptiveSampling) != 0.0;
+            settings.analyticBeams = opt.number("analytic", settings.analyticBeams) != 0.0;
+        }
+        else
+        {
+            ElementKind kind = ParseElementKind(type);
+            if (kind == ElementKind::COUNT)
+                return fail("unknown object type '" + type + "'");
+
+            double c[6];
+            for (double &x : c)
+                if (!(tokens >> x))
+                    return fail("expected position and orientation after '" + type + "'");
+            if (!opt.parse(tokens, error))
+                return fail(error);
+
+            auto obj = scene.AddObject(type, vec3(c[0], c[1], c[2]), vec3(c[3], c[4], c[5]));
+            if (obj->source)
+                applySource(*obj->source, opt, error);
+            else
+                applyElement(*obj, opt, error);
+            if (!error.empty())
+                return fail(error);
+        }
+
+        if (!opt.bad.empty())
+            return fail("bad value for '" + opt.bad + "'");
+        if (!opt.leftover().empty())
+            return fail("unknown key '" + opt.leftover() + "' for " + type);
+    }
+    return true;
+}
+
+void WriteScene(std::ostream &out, Scene &scene, const SimulationSettings &settings)
+{
+    std::ostringstream s;
+    s << std::setprecision(17);
+    s << "Settings adaptive=" << settings.adaptiveSampling << " analytic=" << settings.analyticBeams << "\n";
+
+    for (auto &obj : scene.GetObjects())
+    {
+        vec3 p = obj->getPosition();
+        vec3 o = obj->source ? obj->source->getOrientation() : obj->element ? obj->element->getOrientation() : obj->uiOrientation;
+        s << obj->type << " " << p.x() << " " << p.y() << " " << p.z() << " " << o.x() << " " << o.y() << " " << o.z();
+
+        switch (obj->kind)
+        {
+        case ElementKind::SOURCE:
+        {
+            Source &src = *obj->source;
+            s << " field=" << FIELD_NAMES[min(max((int)src.getFieldType(), 0), 3)] << " wavelength=" << src.getWavelength()
+              << " waist=" << src.getBeamWaist() << " l=" << src.getL() << " p=" << src.getP() << " psi=" << src.getPsi()
+              << " delta=" << src.getDelta() << " guard=" << src.getGuardFactor() << " bandwidth=" << src.getBandwidth()
+              << " samples=" << src.getSpectralSamples() << " coherence=" << src.getCoherenceWidth()
+              << " threshold=" << src.getModeThreshold() << " modes=" << src.getMaxModes();
+            break;
+        }
+        case ElementKind::CAMERA:
+        {
+            Camera &cam = static_cast<Camera &>(*obj->element);
+            s << " size=" << cam.getSize() << " resolution=" << cam.getResolution() << " roi=" << cam.getROISize()
+              << " roix=" << cam.getROIX() << " roiy=" << cam.getROIY() << " zoom=" << cam.getZoomPropagation();
+            break;
+        }
+        case ElementKind::MIRROR:
+        {
+            Mirror &mirror = static_cast<Mirror &>(*obj->element);
+            s << " size=" << mirror.getSize() << " reflectivity=" << mirror.getReflectivity()
+              << " n=" << mirror.getRefractiveIndex().real() << " k=" << mirror.getRefractiveIndex().imag();
+            break;
+        }
+        case ElementKind::CONVEX_LENS:
+        {
+            ConvexLens &lens = static_cast<ConvexLens &>(*obj->element);
+            s << " diameter=" << 2.0 * lens.getRadius() << " focal=" << lens.getFocalLength() << " n=" << lens.getRefractiveIndex();
+            break;
+        }
+        case ElementKind::CONCAVE_LENS:
+        {
+            ConcaveLens &lens = static_cast<ConcaveLens &>(*obj->element);
+            s << " diameter=" << 2.0 * lens.getRadius() << " focal=" << lens.getFocalLength() << " n=" << lens.getRefractiveIndex();
+            break;
+        }
+        case ElementKind::IRIS:
+        {
+            Iris &iris = static_cast<Iris &>(*obj->element);
+            s << " size=" << iris.getSize() << " radius=" << iris.getRadius();
+            break;
+        }
+        case ElementKind::SLIT:
+        {
+            Slit &slit = static_cast<Slit &>(*obj->element);
+            s << " size=" << slit.getSize() << " width=" << slit.getWidth() << " height=" << slit.getHeight()
+              << " count=" << slit.getNumSlits() << " separation=" << slit.getSeparation();
+            break;
+        }
+        default:
+            break;
+        }
+        s << "\n";
+    }
+    out << s.str();
+}
+
+size_t FieldBytes(int N)
+{
+    return 8 + 2 * sizeof(uint32_t) + 2 * sizeof(double) + 2 * (size_t)N * N * 2 * sizeof(double);
+}
+
+void WriteField(std::ostream &out, WaveFront &field)
+{
+    const uint32_t version = 1, n = (uint32_t)field.N;
+    const double pitch = field.getPixelSize(), wavelength = field.getWavelength();
+    out.write("OSLFIELD", 8);
+    out.write((const char *)&version, sizeof(version));
+    out.write((const char *)&n, sizeof(n));
+    out.write((const char *)&pitch, sizeof(pitch));
+    out.write((const char *)&wavelength, sizeof(wavelength));
+
+    const FieldGrid *grids[2] = {&field.Ex, &field.Ey};
+    for (const FieldGrid *grid : grids)
+        for (const auto &row : grid->read())
+            out.write((const char *)row.data(), row.size() * sizeof(std::complex<double>));
+}
+
+void WriteCameraFields(std::ostream &out, Scene &scene)
+{
+    std::vector<Camera *> cameras = scene.GetSensors();
+    const auto &objects = scene.GetObjectsOfKind(ElementKind::CAMERA);
+    for (size_t k = 0; k < cameras.size(); k++)
+    {
+        WaveFront &field = cameras[k]->getSensedWaveFront();
+        out << "CAMERA " << objects[k]->id << " " << FieldBytes(field.N) << "\n";
+        WriteField(out, field);
+    }
+}
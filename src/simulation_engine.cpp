@@ -2,9 +2,17 @@
 #include "ray.hpp"
 #include "wavefront.hpp"
 #include "utils.hpp"
+#include "gaussian_beam.hpp"
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <optional>
+
+struct SimulationEngine::Arrival
+{
+    WaveFront field;
+    std::optional<GaussianBeam> beam; // Set while the member is still carried analytically
+};
 
 std::vector<double> SimulationEngine::FlattenGrid(const std::vector<std::vector<double>> &grid, int N)
 {
@@ -24,48 +32,91 @@ std::vector<double> SimulationEngine::FlattenGrid(const std::vector<std::vector<
     return flat;
 }
 
-std::vector<OpticalElement *> SimulationEngine::Run(Scene &scene)
+// Carries the beam along elements [begin, end) of the path with ABCD matrices. Stops at the first
+// element that needs the sampled field, rasterizes the beam there and hands it over; returns the
+// index of the next element for the wave engine, and sets through if the beam needed none
+size_t SimulationEngine::TraceAnalytic(const Path &path, WaveFront &E_field, const SimulationSettings &settings, GaussianBeam &beam, size_t begin, size_t end, bool &through)
 {
-    std::vector<Source *> Sources = scene.GetActiveSource();
-    std::vector<OpticalElement *> Elements = scene.GetSimulationElements();
+    through = false;
+    for (size_t k = begin; k < end; k++)
+    {
+        auto element = path.Elements[k];
+        double dist = element->hit(beam.getAxis());
+        if (dist == -999.0)
+            continue;
 
-    if (Sources.empty())
-        return scene.GetCameras();
+        beam.propagate(dist);
+        if (element->interact_beam(beam))
+            continue;
+
+        E_field.setPosition(beam.getAxis().pos());
+        E_field.setDirection(beam.getAxis().dir());
+
+        double half_width, max_angle, new_pixel_size;
+        int new_N;
+        beam.samplingHint(half_width, max_angle);
+        max_angle += element->added_angle(half_width, E_field.getWavelength());
+        if (settings.adaptiveSampling && E_field.chooseSampling(half_width, max_angle, path.source->E.N, new_pixel_size, new_N))
+            E_field.setGrid(new_N * new_pixel_size, new_pixel_size);
+        else
+            E_field.scale(0.0);
+
+        beam.rasterize(E_field);
+        element->receive_wavefront(E_field, 0.0);
+        return k + 1;
+    }
+
+    through = true;
+    return end;
+}
+
+bool SimulationEngine::CheckFixedGrid(const SimulationSettings &settings, const Path &path, const std::string &backend, std::string &error)
+{
+    if (settings.analyticBeams || settings.adaptiveSampling)
+        error = backend + " runs sample every field on one fixed grid: the scene needs 'Settings adaptive=0 analytic=0'";
+    else if (path.source->isBatched())
+        error = "broadband and partially coherent sources are not supported by " + backend + " runs";
+    else
+        return true;
+    return false;
+}
+
+bool SimulationEngine::CheckFixedGridStep(const Path &path, const OpticalElement &element, double distance, double fresnelNumber, const std::string &backend, std::string &error)
+{
+    const PropagationMethod method = path.source->E.getPropagationMethod();
+    if (method == PropagationMethod::FRESNEL_SINGLE_FFT || (method == PropagationMethod::AUTO && distance > 0.0 && fresnelNumber < 1.0))
+    {
+        error = "the step to " + element.getName() + " is in the far field (Fresnel number " + std::to_string(fresnelNumber) + "), which " + backend + " runs do not support";
+        return false;
+    }
+    return true;
+}
 
+std::set<SimulationEngine::Path> SimulationEngine::FindPaths(Scene &scene)
+{
+    const ElementBVH &bvh = scene.GetElementBVH();
     std::set<Path> PossiblePaths;
 
-    for (auto Src : Sources)
+    for (auto Src : scene.GetActiveSource())
     {
         for (int i = 1; i <= 5; i++)
         {
             ray beam(Src->getPosition(), Src->getOrientation());
-            std::set<OpticalElement *> interacted_with;
+            std::vector<char> interacted_with(bvh.size(), 0);
             Path CurrentPath;
             CurrentPath.source = Src;
 
             while (beam.isAlive())
             {
-                auto min_dist = INF;
-                OpticalElement *closest_element = NULL;
-
-                for (auto element : Elements)
-                {
-                    if (interacted_with.find(element) != interacted_with.end())
-                        continue;
-                    auto dist = element->hit(beam);
-
-                    if (dist != -999 && dist <= min_dist)
-                    {
-                        closest_element = element;
-                        min_dist = dist;
-                    }
-                }
+                double min_dist;
+                int closest = bvh.closestHit(beam, min_dist, -1, &interacted_with);
 
-                if (closest_element != NULL)
+                if (closest >= 0)
                 {
+                    OpticalElement *closest_element = bvh.element(closest);
                     beam.propagate(min_dist);
                     closest_element->interact_ray(beam);
-                    interacted_with.insert(closest_element);
+                    interacted_with[closest] = 1;
                     CurrentPath.Elements.push_back(closest_element);
                 }
                 else
@@ -76,22 +127,226 @@ std::vector<OpticalElement *> SimulationEngine::Run(Scene &scene)
         }
     }
 
+    return PossiblePaths;
+}
+
+std::vector<OpticalElement *> SimulationEngine::Run(Scene &scene, const SimulationSettings &settings)
+{
+    std::vector<Source *> Sources = scene.GetActiveSource();
+    if (Sources.empty())
+        return scene.GetCameras();
+
+    std::set<Path> PossiblePaths = FindPaths(scene);
+
+    auto cancelled = [&]() { return settings.cancel && settings.cancel->load(std::memory_order_relaxed); };
+
+    // Source fields are only recomputed after one of their parameters changed
     for (auto Src : Sources)
-        Src->E.initialize();
+        if (!Src->isBatched())
+            Src->E.initializeIfChanged();
 
     for (auto Path : PossiblePaths)
     {
-        auto E_field = Path.source->E;
-        for (auto element : Path.Elements)
+        if (cancelled())
+            break;
+        if (Path.source->isBatched())
+            continue;
+
+        auto E_field = Path.source->E; // Shares the source's grids until the first step replaces them
+        size_t start = 0;
+        if (settings.analyticBeams && GaussianBeam::supports(*Path.source))
+        {
+            GaussianBeam beam(*Path.source);
+            bool through;
+            start = TraceAnalytic(Path, E_field, settings, beam, 0, Path.Elements.size(), through);
+        }
+        PropagatePath(Path, E_field, start, Path.Elements.size(), settings);
+    }
+
+    // Broadband and partially coherent sources: their members (wavelengths, coherent modes) are
+    // mutually incoherent with each other, but each member is coherent with itself. Every path of
+    // a member adds its field on the cameras, which then expose the member's intensity before the
+    // next one arrives (the coherent field received so far counts as one exposure of its own)
+    std::vector<Camera *> sensors = scene.GetSensors();
+
+    bool exposed = false;
+    for (auto Src : Sources)
+    {
+        if (!Src->isBatched() || cancelled())
+            continue;
+        if (!exposed)
+        {
+            for (auto cam : sensors)
+                cam->expose(1.0);
+            exposed = true;
+        }
+
+        std::vector<Source> members;
+        std::vector<double> weights;
+        Src->batchMembers(members, weights);
+
+        // The members' grids are only allocated a chunk at a time, each initialized once
+        const size_t chunkSize = (size_t)max(settings.batchSize, 1);
+        for (size_t first = 0; first < members.size() && !cancelled(); first += chunkSize)
         {
-            double dist = element->hit(E_field.getNormal());
-            if (dist != -999.0)
+            std::vector<Source> chunk(members.begin() + first, members.begin() + min(first + chunkSize, members.size()));
+            for (auto &member : chunk)
+                member.E.initialize();
+
+            std::vector<const Path *> paths;
+            std::vector<std::vector<Arrival>> arrivals; // Per path, each member's field as it reaches the camera
+            for (auto &Path : PossiblePaths)
             {
-                E_field.propagate(dist);
-                element->interact_wavefront(E_field);
+                if (Path.source != Src || cancelled())
+                    continue;
+                paths.push_back(&Path);
+                arrivals.emplace_back();
+                PropagateBatch(Path, chunk, settings, arrivals.back());
+            }
+
+            for (size_t m = 0; m < chunk.size() && !cancelled(); m++)
+            {
+                for (size_t k = 0; k < paths.size(); k++)
+                {
+                    if (arrivals[k].empty())
+                        continue; // No camera at the end of this path
+                    Path memberPath = *paths[k];
+                    memberPath.source = &chunk[m];
+                    Arrival &arrival = arrivals[k][m];
+
+                    size_t last = memberPath.Elements.size() - 1;
+                    bool through;
+                    if (arrival.beam)
+                        last = TraceAnalytic(memberPath, arrival.field, settings, *arrival.beam, last, memberPath.Elements.size(), through);
+                    PropagatePath(memberPath, arrival.field, last, memberPath.Elements.size(), settings);
+                }
+                for (auto cam : sensors)
+                    cam->expose(weights[first + m]);
             }
         }
     }
 
+    if (exposed)
+        for (auto cam : sensors)
+            cam->develop();
+
     return scene.GetCameras();
-}
\ No newline at end of file
+}
+
+// Wave-optics part of a path: propagates E_field through the elements [start, end)
+void SimulationEngine::PropagatePath(const Path &path, WaveFront &E_field, size_t start, size_t end, const SimulationSettings &settings)
+{
+    for (size_t k = start; k < end; k++)
+    {
+        if (settings.cancel && settings.cancel->load(std::memory_order_relaxed))
+            return;
+
+        auto element = path.Elements[k];
+        double dist = element->hit(E_field.getNormal());
+        if (dist == -999.0)
+            continue;
+
+        // The last element is a sensor or a dead end and samples the field itself
+        if (settings.adaptiveSampling && k + 1 < path.Elements.size())
+        {
+            double half_width, max_angle, new_pixel_size;
+            int new_N;
+            E_field.predictExtent(dist, half_width, max_angle);
+            max_angle += element->added_angle(half_width, E_field.getWavelength());
+            if (E_field.chooseSampling(half_width, max_angle, path.source->E.N, new_pixel_size, new_N))
+            {
+                E_field.propagateResampled(dist, new_pixel_size, new_N);
+                dist = 0.0;
+            }
+        }
+
+        element->receive_wavefront(E_field, dist);
+    }
+}
+
+// Carries the members of a batched source (one per wavelength and mode) along the path
+// together, up to the camera that ends it. Members that leave the analytic tracer at the same
+// element share every later step: one sampling choice for the widest of them, batched FFTs for the
+// free-space propagation between elements and one zoom step per wavelength when they move to a new
+// grid. The members stop short of the camera, so Run can deliver each member's paths together
+// (arrivals stay empty if no camera ends the path): that last step stays per member, since the
+// member's paths add up on the sensor before its weighted exposure
+void SimulationEngine::PropagateBatch(const Path &path, std::vector<Source> &members, const SimulationSettings &settings, std::vector<Arrival> &arrivals)
+{
+    arrivals.clear();
+    if (path.Elements.empty() || !dynamic_cast<Camera *>(path.Elements.back()))
+        return;
+    const size_t last = path.Elements.size() - 1;
+
+    std::vector<size_t> starts;
+    for (size_t m = 0; m < members.size(); m++)
+    {
+        Path memberPath = path;
+        memberPath.source = &members[m];
+        arrivals.push_back({members[m].E, {}});
+
+        size_t start = 0;
+        if (settings.analyticBeams && GaussianBeam::supports(members[m]))
+        {
+            GaussianBeam beam(members[m]);
+            bool through;
+            start = TraceAnalytic(memberPath, arrivals.back().field, settings, beam, 0, last, through);
+            if (through)
+                arrivals.back().beam = beam; // Still analytic in front of the camera
+        }
+        starts.push_back(start);
+    }
+
+    // Members stopped at different elements (e.g. a lens aperture clipping only the longer
+    // wavelengths or higher modes) continue one at a time
+    if (std::any_of(starts.begin(), starts.end(), [&](size_t start) { return start != starts[0]; }))
+    {
+        for (size_t m = 0; m < members.size(); m++)
+        {
+            Path memberPath = path;
+            memberPath.source = &members[m];
+            PropagatePath(memberPath, arrivals[m].field, starts[m], last, settings);
+        }
+        return;
+    }
+
+    std::vector<WaveFront> fields;
+    for (auto &arrival : arrivals)
+        fields.push_back(std::move(arrival.field));
+
+    for (size_t k = starts[0]; k < last; k++)
+    {
+        if (settings.cancel && settings.cancel->load(std::memory_order_relaxed))
+            break;
+
+        auto element = path.Elements[k];
+        double dist = element->hit(fields[0].getNormal());
+        if (dist == -999.0)
+            continue;
+
+        if (settings.adaptiveSampling)
+        {
+            double half_width = 0.0, max_angle = 0.0, new_pixel_size;
+            int new_N;
+            for (auto &field : fields)
+            {
+                double w, a;
+                field.predictExtent(dist, w, a);
+                half_width = max(half_width, w);
+                max_angle = max(max_angle, a + element->added_angle(w, field.getWavelength()));
+            }
+            if (fields[0].chooseSampling(half_width, max_angle, path.source->E.N, new_pixel_size, new_N))
+            {
+                WaveFront::propagateResampledBatch(fields, dist, new_pixel_size, new_N);
+                dist = 0.0;
+            }
+        }
+
+        WaveFront::propagateBatch(fields, dist);
+        for (auto &field : fields)
+            element->interact_wavefront(field);
+    }
+
+    for (size_t m = 0; m < fields.size(); m++)
+        arrivals[m].field = std::move(fields[m]);
+}
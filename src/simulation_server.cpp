@@ -0,0 +1,187 @@
+#include "simulation_server.hpp"
+#include "serialization.hpp"
+#include "fft_plans.hpp"
+#include <exception>
+#include <iostream>
+#include <sstream>
+
+static const size_t MAX_SCENE_BYTES = 1 << 24; // Rejects requests that cannot be scene descriptions
+static const int REQUEST_TIMEOUT_MS = 10000;   // Time a client has to send its whole request
+
+// Unbuffered output stream onto a connection, so fields are written straight to the socket
+class ConnectionStream : public std::streambuf
+{
+private:
+    Connection &client;
+
+protected:
+    int_type overflow(int_type ch) override
+    {
+        char c = (char)ch;
+        return ch != traits_type::eof() && client.sendAll(&c, 1) ? ch : traits_type::eof();
+    }
+    std::streamsize xsputn(const char *data, std::streamsize count) override
+    {
+        return client.sendAll(data, (size_t)count) ? count : 0;
+    }
+
+public:
+    explicit ConnectionStream(Connection &client) : client(client) {}
+};
+
+bool SimulationServer::Start(int port, bool loopbackOnly)
+{
+    if (!listener.listen(port, loopbackOnly))
+    {
+        std::cerr << "[SimulationServer] Cannot listen on port " << port << std::endl;
+        return false;
+    }
+    // Plans outlive the jobs here, so measuring them once pays off over every later job
+    FftPlans::instance().setPatient(true);
+    quit = false;
+    worker = std::thread(&SimulationServer::Work, this);
+    return true;
+}
+
+void SimulationServer::Serve()
+{
+    while (true)
+    {
+        Connection client = listener.accept();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (quit)
+                return;
+        }
+        if (client.isOpen())
+            Receive(std::move(client));
+    }
+}
+
+void SimulationServer::Stop()
+{
+    std::deque<Job> rejected;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+        rejected.swap(queue);
+    }
+    wake.notify_all();
+    listener.close();
+    if (worker.joinable())
+        worker.join();
+    for (auto &job : rejected)
+        job.client.sendLine("ERROR server shutting down");
+}
+
+size_t SimulationServer::getCompleted()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return completed;
+}
+
+// Requests are small and come from local clients, so they are read on the accepting thread;
+// the timeout keeps a client that stalls from holding up everyone queued behind it
+void SimulationServer::Receive(Connection client)
+{
+    client.setReadTimeout(REQUEST_TIMEOUT_MS);
+    std::string request;
+    if (!client.readLine(request))
+        return;
+
+    std::istringstream words(request);
+    std::string command;
+    size_t bytes = 0;
+    if (!(words >> command >> bytes) || command != "SIMULATE" || bytes > MAX_SCENE_BYTES)
+    {
+        client.sendLine("ERROR expected SIMULATE <bytes>");
+        return;
+    }
+
+    std::string text(bytes, '\0');
+    if (!client.readExactly(&text[0], bytes))
+        return;
+
+    Job job;
+    job.scene = std::make_unique<Scene>();
+    std::istringstream in(text);
+    std::string error;
+    bool read;
+    try
+    {
+        read = ReadScene(in, *job.scene, job.settings, error); // Allocates the sensors
+    }
+    catch (const std::exception &e)
+    {
+        read = false;
+        error = std::string("cannot set up the scene: ") + e.what();
+    }
+    if (!read)
+    {
+        client.sendLine("ERROR " + error);
+        return;
+    }
+    client.setReadTimeout(0);
+    job.client = std::move(client);
+
+    size_t ahead;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        ahead = queue.size() + (running ? 1 : 0);
+        job.client.sendLine("QUEUED " + std::to_string(ahead));
+        queue.push_back(std::move(job));
+    }
+    wake.notify_one();
+}
+
+void SimulationServer::Work()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+        wake.wait(guard, [this]() { return quit || !queue.empty(); });
+        if (quit)
+            return;
+
+        Job job = std::move(queue.front());
+        queue.pop_front();
+        running = true;
+
+        guard.unlock();
+        try
+        {
+            SimulationEngine::Run(*job.scene, job.settings);
+            Reply(job);
+        }
+        catch (const std::exception &e) // Out of memory, mostly; the server carries on with the next job
+        {
+            std::cerr << "[SimulationServer] Job failed: " << e.what() << std::endl;
+            job.client.sendLine(std::string("ERROR simulation failed: ") + e.what());
+        }
+        job.scene.reset(); // Frees the scene's fields before the next job starts; the FFT work buffers went back to the pool as the run ended
+        guard.lock();
+
+        running = false;
+        completed++;
+    }
+}
+
+void SimulationServer::Reply(Job &job)
+{
+    std::vector<Camera *> cameras = job.scene->GetSensors();
+    const auto &objects = job.scene->GetObjectsOfKind(ElementKind::CAMERA);
+    if (!job.client.sendLine("OK " + std::to_string(cameras.size())))
+        return; // The client went away; nothing to stream
+
+    ConnectionStream stream(job.client);
+    std::ostream out(&stream);
+    for (size_t k = 0; k < cameras.size(); k++)
+    {
+        WaveFront &field = cameras[k]->getSensedWaveFront();
+        if (!job.client.sendLine("CAMERA " + std::to_string(objects[k]->id) + " " + std::to_string(FieldBytes(field.N))))
+            return;
+        WriteField(out, field);
+        if (!out)
+            return;
+    }
+}
@@ -0,0 +1,113 @@
+#include "source.hpp"
+#include <cmath>
+
+// Evenly spaced wavelengths across the FWHM either side of the centre, with weights following
+// the Gaussian spectrum and summing to one (the centre wavelength alone if monochromatic)
+void Source::sampleSpectrum(std::vector<double> &wavelengths, std::vector<double> &weights) const
+{
+    wavelengths.clear();
+    weights.clear();
+    if (!isBroadband())
+    {
+        wavelengths.push_back(wavelength);
+        weights.push_back(1.0);
+        return;
+    }
+
+    double total = 0.0;
+    for (int k = 0; k < spectralSamples; k++)
+    {
+        double offset = bandwidth * (2.0 * k / (spectralSamples - 1) - 1.0);
+        wavelengths.push_back(wavelength + offset);
+        weights.push_back(std::exp(-4.0 * std::log(2.0) * sq(offset / bandwidth)));
+        total += weights.back();
+    }
+    for (auto &weight : weights)
+        weight /= total;
+}
+
+// Coherent-mode decomposition of a Gaussian Schell-model source (Gori 1980; Starikov & Wolf
+// 1982) with the intensity profile of the coherent beam, exp(-2r^2/w0^2), and coherence
+// exp(-d^2 / 2 sigma^2). With a = 1/w0^2, b = 1/(2 sigma^2) and c = sqrt(a^2 + 2ab) the modes
+// are HG_mn of waist 1/sqrt(c), carrying kappa^(m+n) of the fundamental's power, kappa = b/(a+b+c).
+// Weights are power fractions summing to one over the retained modes; all orders together carry
+// 1 / (1 - kappa)^2 of the fundamental's power, which gives the fraction dropped
+void Source::sampleModes(std::vector<int> &m, std::vector<int> &n, std::vector<double> &weights, double &waist, double &dropped) const
+{
+    m.clear();
+    n.clear();
+    weights.clear();
+    dropped = 0.0;
+    if (!isPartiallyCoherent())
+    {
+        m.push_back(0);
+        n.push_back(0);
+        weights.push_back(1.0);
+        waist = w0;
+        return;
+    }
+
+    const double a = 1.0 / (w0 * w0);
+    const double b = 1.0 / (2.0 * coherenceWidth * coherenceWidth);
+    const double c = std::sqrt(a * a + 2.0 * a * b);
+    const double kappa = b / (a + b + c);
+    waist = 1.0 / std::sqrt(c);
+
+    // kappa^order >= threshold bounds the total order of the retained modes, and maxModes the
+    // number of whole orders (order o adds o + 1 modes)
+    int max_order = (int)std::floor(std::log(modeThreshold) / std::log(kappa) + 1e-9);
+    while (max_order > 0 && (max_order + 1) * (max_order + 2) / 2 > maxModes)
+        max_order--;
+
+    double total = 0.0;
+    for (int order = 0; order <= max_order; order++)
+    {
+        double beta = std::pow(kappa, order);
+        for (int i = 0; i <= order; i++)
+        {
+            m.push_back(i);
+            n.push_back(order - i);
+            weights.push_back(beta);
+            total += beta;
+        }
+    }
+    for (auto &weight : weights)
+        weight /= total;
+    dropped = max(0.0, 1.0 - total * sq(1.0 - kappa));
+}
+
+// Every combination of sampled wavelength and coherent mode. WaveFront's HG_mn fields carry
+// 2^(m+n) m! n! times the power of the fundamental, which the weights divide out (in the log domain)
+void Source::batchMembers(std::vector<Source> &members, std::vector<double> &weights) const
+{
+    std::vector<double> wavelengths, spectrum;
+    std::vector<int> m, n;
+    std::vector<double> modes;
+    double waist, dropped;
+    sampleSpectrum(wavelengths, spectrum);
+    sampleModes(m, n, modes, waist, dropped);
+
+    members.clear();
+    weights.clear();
+    for (size_t k = 0; k < wavelengths.size(); k++)
+    {
+        for (size_t q = 0; q < modes.size(); q++)
+        {
+            members.push_back(*this);
+            Source &member = members.back();
+            member.bandwidth = 0.0;
+            member.coherenceWidth = 0.0;
+            member.setWavelength(wavelengths[k]);
+
+            double weight = spectrum[k] * modes[q];
+            if (isPartiallyCoherent())
+            {
+                member.setFieldType(FieldType::HG);
+                member.setBeamMode(m[q], n[q]);
+                member.setBeamWaist(waist);
+                weight *= std::exp(-hermiteLogNorm(m[q]) - hermiteLogNorm(n[q]));
+            }
+            weights.push_back(weight);
+        }
+    }
+}
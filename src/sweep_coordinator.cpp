@@ -0,0 +1,463 @@
+#include "sweep_coordinator.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "serialization.hpp"
+
+static const int MAX_WORKER_FAILURES = 3; // Consecutive failed jobs after which a worker is given up on
+
+// FNV-1a, stable across builds so a checkpoint can be matched to its sweep
+static uint64_t fingerprint(const std::string &text)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : text)
+        h = (h ^ c) * 1099511628211ull;
+    return h;
+}
+
+size_t SweepSpec::jobCount() const
+{
+    size_t count = 1;
+    for (auto &axis : axes)
+        count *= axis.values.size();
+    return count;
+}
+
+std::string SweepSpec::jobScene(size_t job) const
+{
+    std::vector<std::string> scene = lines;
+    for (size_t a = axes.size(); a-- > 0;)
+    {
+        const SweepAxis &axis = axes[a];
+        scene[objectLine[axis.object - 1]] += " " + axis.key + "=" + axis.values[job % axis.values.size()]; // Later keys override the base's
+        job /= axis.values.size();
+    }
+
+    std::string text;
+    for (auto &line : scene)
+        text += line + "\n";
+    return text;
+}
+
+std::string SweepSpec::jobLabel(size_t job) const
+{
+    std::vector<std::string> parts(axes.size());
+    for (size_t a = axes.size(); a-- > 0;)
+    {
+        const SweepAxis &axis = axes[a];
+        parts[a] = std::to_string(axis.object) + ":" + axis.key + "=" + axis.values[job % axis.values.size()];
+        job /= axis.values.size();
+    }
+
+    std::string label;
+    for (auto &part : parts)
+        label += (label.empty() ? "" : " ") + part;
+    return label;
+}
+
+bool ReadSweep(std::istream &in, SweepSpec &spec, std::string &error)
+{
+    spec = SweepSpec();
+    std::string line;
+    int number = 0;
+    while (std::getline(in, line))
+    {
+        number++;
+        spec.text += line + "\n";
+        std::istringstream tokens(line);
+        std::string first;
+        if (!(tokens >> first) || first[0] == '#')
+        {
+            spec.lines.push_back(line);
+            continue;
+        }
+        if (first != "Sweep")
+        {
+            if (first != "Settings")
+                spec.objectLine.push_back((int)spec.lines.size());
+            spec.lines.push_back(line);
+            continue;
+        }
+
+        SweepAxis axis;
+        std::string word;
+        if (!(tokens >> axis.object >> axis.key))
+        {
+            error = "line " + std::to_string(number) + ": expected Sweep <object> <key> <values>";
+            return false;
+        }
+        while (tokens >> word)
+        {
+            if (word == "range" && axis.values.empty())
+            {
+                double first_value, last_value;
+                int count;
+                if (!(tokens >> first_value >> last_value >> count) || count < 1)
+                {
+                    error = "line " + std::to_string(number) + ": expected range <first> <last> <count>";
+                    return false;
+                }
+                for (int k = 0; k < count; k++)
+                {
+                    std::ostringstream value;
+                    value << std::setprecision(12) << (count == 1 ? first_value : first_value + (last_value - first_value) * k / (count - 1));
+                    axis.values.push_back(value.str());
+                }
+                break;
+            }
+            axis.values.push_back(word);
+        }
+        if (axis.values.empty())
+        {
+            error = "line " + std::to_string(number) + ": no values to sweep";
+            return false;
+        }
+        spec.axes.push_back(axis);
+    }
+
+    for (auto &axis : spec.axes)
+        if (axis.object < 1 || axis.object > (int)spec.objectLine.size())
+        {
+            error = "sweep over object " + std::to_string(axis.object) + ", but the scene has " + std::to_string(spec.objectLine.size());
+            return false;
+        }
+
+    // The first job exercises every swept key, so typos show up before any work is sent out
+    Scene scene;
+    SimulationSettings settings;
+    std::istringstream first(spec.jobScene(0));
+    if (!ReadScene(first, scene, settings, error))
+    {
+        error = "job 0: " + error;
+        return false;
+    }
+    return true;
+}
+
+bool SweepCoordinator::ParseWorkers(const std::string &list, std::vector<Worker> &workers, std::string &error)
+{
+    std::istringstream items(list);
+    std::string item;
+    while (std::getline(items, item, ','))
+    {
+        size_t colon = item.rfind(':');
+        int port = colon == std::string::npos ? 0 : std::atoi(item.c_str() + colon + 1);
+        if (colon == 0 || port <= 0 || port > 65535)
+        {
+            error = "expected host:port, got '" + item + "'";
+            return false;
+        }
+        workers.push_back({item.substr(0, colon), port});
+    }
+    if (workers.empty())
+    {
+        error = "no workers given";
+        return false;
+    }
+    return true;
+}
+
+bool SweepCoordinator::Resume(const std::string &archivePath, const std::string &checkpointPath, std::string &error)
+{
+    namespace fs = std::filesystem;
+    std::ostringstream header, prologue;
+    header << "SWEEP " << spec->jobCount() << " " << std::hex << fingerprint(spec->text);
+    prologue << "OSLSWEEP 1\nSPEC " << spec->text.size() << "\n" << spec->text;
+    const std::string start = prologue.str();
+
+    // An archive of this sweep starts with its description
+    std::error_code ec;
+    const unsigned long long size = fs::exists(archivePath, ec) ? (unsigned long long)fs::file_size(archivePath, ec) : 0;
+    bool matches = false;
+    if (!ec && size >= start.size())
+    {
+        std::string found(start.size(), '\0');
+        std::ifstream in(archivePath, std::ios::binary);
+        matches = in.read(&found[0], (std::streamsize)found.size()) && found == start;
+    }
+
+    // Records are trusted up to the first line that a crash could have left behind: one without
+    // its newline, with trailing garbage, a job out of range or an archive offset that does not
+    // grow or lies past the end of the archive
+    std::vector<size_t> done;
+    std::vector<std::string> kept;
+    unsigned long long offset = start.size();
+    std::ifstream previous(checkpointPath);
+    std::string line;
+    if (previous && std::getline(previous, line))
+    {
+        if (line != header.str())
+        {
+            error = checkpointPath + " belongs to a different sweep";
+            return false;
+        }
+        while (std::getline(previous, line) && !previous.eof())
+        {
+            std::istringstream fields(line);
+            size_t job;
+            unsigned long long end;
+            std::string rest;
+            if (!(fields >> job >> end) || fields >> rest || job >= spec->jobCount() || end <= offset || end > size)
+                break;
+            done.push_back(job);
+            kept.push_back(line);
+            offset = end;
+        }
+    }
+    previous.close();
+
+    if (!done.empty() && matches)
+    {
+        fs::resize_file(archivePath, offset, ec); // Drops records of jobs that were cut off
+        archive.open(archivePath, std::ios::in | std::ios::out | std::ios::binary);
+        archive.seekp(0, std::ios::end);
+    }
+    else
+    {
+        done.clear();
+        kept.clear();
+        archive.open(archivePath, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        archive << start;
+    }
+    checkpoint.open(checkpointPath, std::ios::trunc); // Rewritten without the lines dropped above, so appends start on a line of their own
+    checkpoint << header.str() << "\n";
+    for (auto &record : kept)
+        checkpoint << record << "\n";
+    archive.flush();
+    checkpoint.flush();
+    if (!archive || !checkpoint)
+    {
+        error = "cannot write " + archivePath + " or " + checkpointPath;
+        return false;
+    }
+
+    for (size_t job : done)
+        if (state[job] != JobState::DONE)
+        {
+            state[job] = JobState::DONE;
+            remaining--;
+            completed++;
+        }
+    return true;
+}
+
+bool SweepCoordinator::Run(const SweepSpec &sweep, const std::vector<Worker> &workers, const std::string &archivePath, const std::string &checkpointPath, std::string &error)
+{
+    spec = &sweep;
+    const size_t jobs = sweep.jobCount();
+    state.assign(jobs, JobState::QUEUED);
+    runners.assign(jobs, 0);
+    links.assign(jobs, {});
+    remaining = jobs;
+    completed = failed = 0;
+    writeFailed = false;
+    queue.clear();
+
+    if (!Resume(archivePath, checkpointPath, error))
+        return false;
+    for (size_t job = 0; job < jobs; job++)
+        if (state[job] == JobState::QUEUED)
+            queue.push_back(job);
+
+    std::vector<std::thread> drivers;
+    for (auto &worker : workers)
+        drivers.emplace_back(&SweepCoordinator::Drive, this, worker);
+    for (auto &driver : drivers)
+        driver.join();
+
+    archive.close();
+    checkpoint.close();
+    if (writeFailed)
+    {
+        error = "cannot write " + archivePath + " or " + checkpointPath + ": sweep stopped, rerun to resume";
+        return false;
+    }
+    if (remaining > 0)
+    {
+        error = std::to_string(remaining) + " jobs left undone: no worker could run them";
+        return false;
+    }
+    return true;
+}
+
+bool SweepCoordinator::Next(size_t &job)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+        if (remaining == 0 || writeFailed)
+            return false;
+        if (!queue.empty())
+        {
+            job = queue.front();
+            queue.pop_front();
+            state[job] = JobState::RUNNING;
+            runners[job]++;
+            return true;
+        }
+        // Nothing queued: back up the oldest job that only one worker is running
+        for (size_t j = 0; j < state.size(); j++)
+            if (state[j] == JobState::RUNNING && runners[j] == 1)
+            {
+                job = j;
+                runners[j]++;
+                return true;
+            }
+        changed.wait(guard);
+    }
+}
+
+bool SweepCoordinator::Attach(size_t job, Connection &server)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (state[job] == JobState::DONE)
+        return false;
+    links[job].push_back(&server);
+    return true;
+}
+
+bool SweepCoordinator::Finish(size_t job, Connection &server, bool succeeded, bool rejected, const std::vector<std::pair<int, std::string>> &fields)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    runners[job]--;
+    auto &open = links[job];
+    open.erase(std::remove(open.begin(), open.end(), &server), open.end());
+
+    if (state[job] == JobState::DONE) // A backup copy already delivered this job
+    {
+        changed.notify_all();
+        return false;
+    }
+
+    if (succeeded)
+    {
+        const std::string label = spec->jobLabel(job);
+        for (auto &field : fields)
+        {
+            archive << "RESULT " << job << " " << field.first << " " << field.second.size() << " " << label << "\n";
+            archive.write(field.second.data(), (std::streamsize)field.second.size());
+        }
+        archive.flush();
+        const std::streamoff end = archive ? (std::streamoff)archive.tellp() : -1;
+        if (end >= 0)
+        {
+            checkpoint << job << " " << (unsigned long long)end << "\n"; // Only after the records are on disk
+            checkpoint.flush();
+        }
+        if (end < 0 || !checkpoint)
+        {
+            // A full disk or a lost file: the job stays unfinished in the checkpoint and every
+            // other run is cut off, since none of their results could be kept either
+            writeFailed = true;
+            for (auto &others : links)
+                for (Connection *other : others)
+                    other->shutdown();
+            changed.notify_all();
+            return true;
+        }
+        state[job] = JobState::DONE;
+        remaining--;
+        completed++;
+    }
+    else if (rejected)
+    {
+        state[job] = JobState::DONE; // Not checkpointed, so a rerun tries it again
+        remaining--;
+        failed++;
+    }
+    else if (runners[job] == 0)
+    {
+        state[job] = JobState::QUEUED;
+        queue.push_front(job);
+    }
+
+    // The other copies can only lose now; a server that hung on one would otherwise keep its
+    // driver, and so Run, waiting forever
+    if (state[job] == JobState::DONE)
+        for (Connection *other : open)
+            other->shutdown();
+    changed.notify_all();
+    return true;
+}
+
+// Runs one job on one server. Returns 0 with the fields on success, 1 if the connection failed
+// and 2 if the server rejected the job (message set)
+static int simulateRemote(Connection &server, const std::string &scene, std::vector<std::pair<int, std::string>> &fields, std::string &message)
+{
+    if (!server.isOpen() || !server.sendLine("SIMULATE " + std::to_string(scene.size())) || !server.sendAll(scene.data(), scene.size()))
+        return 1;
+
+    std::string line, word;
+    size_t count = 0;
+    while (server.readLine(line))
+    {
+        std::istringstream words(line);
+        words >> word;
+        if (word == "ERROR")
+        {
+            message = line.substr(min(line.size(), (size_t)6));
+            return 2;
+        }
+        if (word == "OK" && (words >> count))
+            break;
+        if (word != "QUEUED")
+            return 1;
+    }
+    if (word != "OK")
+        return 1;
+
+    for (size_t k = 0; k < count; k++)
+    {
+        int id;
+        size_t bytes;
+        if (!server.readLine(line))
+            return 1;
+        std::istringstream words(line);
+        if (!(words >> word >> id >> bytes) || word != "CAMERA")
+            return 1;
+        std::string data(bytes, '\0');
+        if (bytes > 0 && !server.readExactly(&data[0], bytes))
+            return 1;
+        fields.emplace_back(id, std::move(data));
+    }
+    return 0;
+}
+
+void SweepCoordinator::Drive(Worker worker)
+{
+    const std::string name = worker.host + ":" + std::to_string(worker.port);
+    int failures = 0;
+    size_t job;
+    while (Next(job))
+    {
+        std::vector<std::pair<int, std::string>> fields;
+        std::string message;
+        Connection server = Connection::connect(worker.host, worker.port);
+        int result = Attach(job, server) ? simulateRemote(server, spec->jobScene(job), fields, message) : 1;
+        if (!Finish(job, server, result == 0, result == 2, fields))
+        {
+            failures = 0; // Cut off or never started because another copy won; says nothing about the server
+            continue;
+        }
+
+        if (result == 2)
+            std::cerr << "[SweepCoordinator] Job " << job << " rejected by " << name << ": " << message << std::endl;
+        if (result != 1)
+        {
+            failures = 0;
+            continue;
+        }
+        if (++failures >= MAX_WORKER_FAILURES)
+        {
+            std::cerr << "[SweepCoordinator] Giving up on " << name << std::endl;
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(failures));
+    }
+}
@@ -28,4 +28,32 @@ double hermitePol(int n, double x)
         Hnm1 = Hn;
     }
     return Hn;
+}
+
+double hermiteFunction(int n, double x)
+{
+    // h_{k+1} = sqrt(2 / (k + 1)) x h_k - sqrt(k / (k + 1)) h_{k-1}, the recursion of H_k rescaled
+    double hkm1 = 0.0, hk = std::exp(-0.5 * x * x);
+    for (int k = 0; k < n; ++k)
+    {
+        double next = std::sqrt(2.0 / (k + 1)) * x * hk - std::sqrt(double(k) / (k + 1)) * hkm1;
+        hkm1 = hk;
+        hk = next;
+    }
+    return hk;
+}
+
+int nextFastFFTSize(int n)
+{
+    // Even sizes keep the (-1)^(i+j) centring of the FFT grids exact
+    int m = (n <= 2) ? 2 : n + (n & 1);
+    for (;; m += 2)
+    {
+        int r = m;
+        for (int f : {2, 3, 5, 7})
+            while (r % f == 0)
+                r /= f;
+        if (r == 1)
+            return m;
+    }
 }
\ No newline at end of file
@@ -1,4 +1,7 @@
 #include "wavefront.hpp"
+#include "buffer_pool.hpp"
+#include "fft_plans.hpp"
+#include <algorithm>
 #include "utils.hpp"
 #include <stdexcept>
 #include <cmath>
@@ -6,12 +9,24 @@
 WaveFront::WaveFront(ray normal, double wavelength, FieldType source, double psi, double delta, double w0, int l, int p, double size, double pixel_size)
     : size(size), pixel_size(pixel_size), normal(normal), wavelength(wavelength), source(source), w0(w0), l(l), p(p), psi(psi), delta(delta)
 {
-    N = (int)(size / pixel_size);
-    Ex.resize(N, std::vector<std::complex<double>>(N, {0.0, 0.0}));
-    Ey.resize(N, std::vector<std::complex<double>>(N, {0.0, 0.0}));
+    resizeGrid();
     get_LocalFrame();
 }
 
+void WaveFront::resizeGrid()
+{
+    N = nextFastFFTSize((int)std::lround(size / pixel_size));
+    size = N * pixel_size;
+    Ex.assign(N);
+    Ey.assign(N);
+    keyValid = false;
+}
+
+int WaveFront::paddedSize() const
+{
+    return nextFastFFTSize((int)std::ceil(N * guard));
+}
+
 double WaveFront::getSize() { return size; }
 double WaveFront::getPixelSize() { return pixel_size; }
 double WaveFront::getWavelength() { return wavelength; }
@@ -26,125 +41,719 @@ void WaveFront::get_LocalFrame()
     u = cross(w, v);
 }
 
+FieldSlab::FieldSlab(WaveFront &A)
+    : n(A.N), centre(A.N / 2), first(0), pixel_size(A.getPixelSize()), wavelength(A.getWavelength()), origin(A.getNormal().pos()), u(A.u), v(A.v)
+{
+    FieldGrid::Rows &x = A.Ex.write(), &y = A.Ey.write();
+    for (int i = 0; i < A.N; i++)
+    {
+        ex.push_back(x[i].data());
+        ey.push_back(y[i].data());
+    }
+}
+
+double WaveFront::fresnelNumber(double z) const
+{
+    if (z == 0.0)
+        return INF;
+    return N * pixel_size * pixel_size / (wavelength * std::abs(z));
+}
+
+PropagationMethod WaveFront::selectMethod(double z) const
+{
+    if (method != PropagationMethod::AUTO)
+        return method;
+
+    // The transfer function is adequately sampled while N*dx^2/(lambda*z) >= 1; beyond that
+    // the single-FFT transform samples the far field better (its output pitch grows with z)
+    if (z > 0.0 && fresnelNumber(z) < 1.0)
+        return PropagationMethod::FRESNEL_SINGLE_FFT;
+    return PropagationMethod::ANGULAR_SPECTRUM;
+}
+
 void WaveFront::propagate(double z)
 {
-    ;
     if (z == 0.0)
         return;
 
+    PropagationMethod m = selectMethod(z);
+    if (m == PropagationMethod::FRESNEL_SINGLE_FFT && z > 0.0)
+        propagateSingleFFT(z);
+    else
+        propagateTransferFunction(z, m != PropagationMethod::FRESNEL);
+
     normal.propagate(z);
+}
 
-    const double dx = pixel_size;
-    const double k_mag = 2 * PI / wavelength;
+// Propagates every field of the batch a distance z. Fields on the same grid that would use a
+// transfer function are transformed together by one pair of batched plans (both components of
+// every field), and fields of equal wavelength share the kernel; anything else steps on its own
+void WaveFront::propagateBatch(std::vector<WaveFront> &batch, double z)
+{
+    if (z == 0.0 || batch.empty())
+        return;
 
-    fftw_complex *inp = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * N * N);
-    fftw_complex *out = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * N * N);
+    bool batched = batch.size() > 1;
+    for (auto &field : batch)
+    {
+        PropagationMethod m = field.selectMethod(z);
+        if (m == PropagationMethod::FRESNEL_SINGLE_FFT && z > 0.0)
+            batched = false; // Changes the pixel size with the wavelength
+        if (!field.sameGrid(batch[0]) || field.guard != batch[0].guard || m != batch[0].selectMethod(z))
+            batched = false;
+    }
+    if (!batched)
+    {
+        for (auto &field : batch)
+            field.propagate(z);
+        return;
+    }
+
+    const bool exact = batch[0].selectMethod(z) != PropagationMethod::FRESNEL;
+    const int n = batch[0].paddedSize();
+    const int count = 2 * (int)batch.size(); // Ex and Ey of every field
+    const size_t slice = (size_t)n * n;
+
+    PooledBuffer buf(count * slice);
+    fftw_plan forward = FftPlans::instance().get(2, n, count, 1, (int)slice, FFTW_FORWARD, true);
+    fftw_plan inverse = FftPlans::instance().get(2, n, count, 1, (int)slice, FFTW_BACKWARD, true);
 
-    if (!inp || !out)
+    for (size_t f = 0; f < batch.size(); f++)
     {
-        if (inp)
-            fftw_free(inp);
-        if (out)
-            fftw_free(out);
-        throw std::bad_alloc();
+        batch[f].embedCentred(batch[f].Ex.read(), buf.fftw() + (2 * f) * slice, n);
+        batch[f].embedCentred(batch[f].Ey.read(), buf.fftw() + (2 * f + 1) * slice, n);
     }
 
-    auto process_component = [&](const std::vector<std::vector<std::complex<double>>> &A,
-                                 std::vector<std::vector<std::complex<double>>> &Aout)
+    fftw_execute_dft(forward, buf.fftw(), buf.fftw());
+
+    std::vector<std::pair<double, PooledBuffer>> kernels; // Wavelength -> transfer function
+    for (size_t f = 0; f < batch.size(); f++)
+    {
+        const PooledBuffer *H = nullptr;
+        for (auto &kernel : kernels)
+            if (kernel.first == batch[f].wavelength)
+                H = &kernel.second;
+        if (!H)
+        {
+            kernels.emplace_back(batch[f].wavelength, batch[f].transferFunction(z, exact, n));
+            H = &kernels.back().second;
+        }
+
+        std::complex<double> *S = buf.data() + (2 * f) * slice;
+#pragma omp parallel for schedule(static)
+        for (int kidx = 0; kidx < (int)slice; ++kidx)
+        {
+            S[kidx] *= (*H)[kidx];
+            S[kidx + slice] *= (*H)[kidx];
+        }
+    }
+
+    fftw_execute_dft(inverse, buf.fftw(), buf.fftw());
+
+    const double norm = 1.0 / (double(n) * n);
+    for (size_t f = 0; f < batch.size(); f++)
+    {
+        batch[f].extractCentred(buf.fftw() + (2 * f) * slice, n, norm, batch[f].Ex);
+        batch[f].extractCentred(buf.fftw() + (2 * f + 1) * slice, n, norm, batch[f].Ey);
+        batch[f].normal.propagate(z);
+    }
+}
+
+// Applies a centred, shift-invariant filter H(fx, fy) on an n x n (zero padded) grid to both field components
+void WaveFront::applyTransferFunction(const PooledBuffer &H, int n)
+{
+    PooledBuffer inp_buf(n * n), out_buf(n * n);
+    fftw_complex *inp = inp_buf.fftw();
+    fftw_complex *out = out_buf.fftw();
+
+    fftw_plan forward = FftPlans::instance().get2D(n, FFTW_FORWARD, false);
+    fftw_plan inverse = FftPlans::instance().get2D(n, FFTW_BACKWARD, false);
+
+    // The (-1)^(i+j) factors move the zero frequency (and the optical axis) to the grid centre;
+    // the field is embedded in the middle of the padded grid and cropped back afterwards
+    auto process_component = [&](FieldGrid &grid)
+    {
+        embedCentred(grid.read(), inp, n);
+
+        fftw_execute_dft(forward, inp, out);
+
+        for (int kidx = 0; kidx < n * n; ++kidx)
+        {
+            std::complex<double> S(out[kidx][0], out[kidx][1]);
+            S *= H[kidx];
+            out[kidx][0] = S.real();
+            out[kidx][1] = S.imag();
+        }
+
+        fftw_execute_dft(inverse, out, inp);
+
+        extractCentred(inp, n, 1.0 / (double(n) * n), grid);
+    };
+
+    process_component(Ex);
+    process_component(Ey);
+}
+
+TransferFunction::TransferFunction(double z, double wavelength, double pixel_size, int n, bool exact)
+    : z(z), wavelength(wavelength), n(n), exact(exact)
+{
+    df = 1.0 / (n * pixel_size);
+    inv_lambda2 = 1.0 / (wavelength * wavelength);
+
+    // Band limit of the angular spectrum kernel (Matsushima & Shimobaba, 2009): beyond this
+    // frequency the kernel's phase is undersampled by the grid and only produces aliasing
+    f_limit = 1.0 / (wavelength * std::sqrt(sq(2.0 * df * z) + 1.0));
+
+    carrier = std::polar(1.0, 2 * PI * z / wavelength);
+}
+
+std::complex<double> TransferFunction::operator()(int u, int v) const
+{
+    double fy = double(u - n / 2) * df;
+    double fx = double(v - n / 2) * df;
+    double f2 = fx * fx + fy * fy;
+
+    if (!exact)
+        return carrier * std::polar(1.0, -PI * wavelength * z * f2);
+
+    if (f2 >= inv_lambda2 || std::abs(fx) > f_limit || std::abs(fy) > f_limit)
+        return 0.0; // Evanescent or band-limited
+
+    // sqrt(1/lambda^2 - f^2) - 1/lambda, written to avoid cancellation near the axis
+    double kz_excess = -f2 / (std::sqrt(inv_lambda2 - f2) + 1.0 / wavelength);
+    return carrier * std::polar(1.0, 2 * PI * z * kz_excess);
+}
+
+PooledBuffer WaveFront::transferFunction(double z, bool exact, int n) const
+{
+    TransferFunction kernel(z, wavelength, pixel_size, n, exact);
+    PooledBuffer H(n * n);
+
+    for (int u = 0; u < n; ++u)
+        for (int v = 0; v < n; ++v)
+            H[u * n + v] = kernel(u, v);
+
+    return H;
+}
+
+void WaveFront::propagateTransferFunction(double z, bool exact)
+{
+    int n = paddedSize();
+    applyTransferFunction(transferFunction(z, exact, n), n);
+}
+
+// Copies A, multiplied by (-1)^(i+j), into the centre of a zeroed n x n buffer
+void WaveFront::embedCentred(const std::vector<std::vector<std::complex<double>>> &A, fftw_complex *buf, int n) const
+{
+    const int pad = (n - N) / 2;
+
+    if (n != N)
+        std::fill(&buf[0][0], &buf[0][0] + 2 * n * n, 0.0);
+
+    for (int i = 0; i < N; ++i)
+        for (int j = 0; j < N; ++j)
+        {
+            int kidx = (i + pad) * n + (j + pad);
+            double s = ((i + j) & 1) ? -1.0 : 1.0;
+            buf[kidx][0] = s * A[i][j].real();
+            buf[kidx][1] = s * A[i][j].imag();
+        }
+}
+
+// Crops the centre of an n x n buffer into grid, undoing the (-1)^(i+j) factors of embedCentred
+void WaveFront::extractCentred(const fftw_complex *buf, int n, double norm, FieldGrid &grid) const
+{
+    const int pad = (n - N) / 2;
+
+    FieldGrid::Rows &A = grid.replace();
+    for (int i = 0; i < N; ++i)
+        for (int j = 0; j < N; ++j)
+        {
+            int kidx = (i + pad) * n + (j + pad);
+            double s = ((i + j) & 1) ? -norm : norm;
+            A[i][j] = std::complex<double>(s * buf[kidx][0], s * buf[kidx][1]);
+        }
+}
+
+PooledBuffer WaveFront::centredSpectrum(const std::vector<std::vector<std::complex<double>>> &A, int n) const
+{
+    PooledBuffer S(n * n);
+
+    fftw_plan forward = FftPlans::instance().get2D(n, FFTW_FORWARD, true);
+    embedCentred(A, S.fftw(), n);
+    fftw_execute_dft(forward, S.fftw(), S.fftw());
+    return S;
+}
+
+void WaveFront::propagateSingleFFT(double z)
+{
+    const double dx_in = pixel_size;
+    const double dx_out = wavelength * z / (N * dx_in);
+    const double k = 2 * PI / wavelength;
+
+    PooledBuffer inp_buf(N * N), out_buf(N * N);
+    fftw_complex *inp = inp_buf.fftw();
+    fftw_complex *out = out_buf.fftw();
+
+    fftw_plan forward = FftPlans::instance().get2D(N, FFTW_FORWARD, false);
+
+    // U2(x2) = e^{ikz} / (i lambda z) e^{ik x2^2 / 2z} FT[U1(x1) e^{ik x1^2 / 2z}] dx1^2
+    // The (-1)^(i+j) factors on both sides centre the DFT; each axis also contributes
+    // e^{-i pi N / 2} = (-1)^(N/2), and the two axes' factors cancel, whatever the parity of N / 2
+    PooledBuffer chirp_in(N * N), chirp_out(N * N);
+    std::complex<double> prefactor = std::polar(1.0, k * z) / std::complex<double>(0.0, wavelength * z) * (dx_in * dx_in);
+    for (int i = 0; i < N; ++i)
     {
+        double y = (i - N / 2) * dx_in;
+        double y2 = (i - N / 2) * dx_out;
+        for (int j = 0; j < N; ++j)
+        {
+            double x = (j - N / 2) * dx_in;
+            double x2 = (j - N / 2) * dx_out;
+            double s = ((i + j) & 1) ? -1.0 : 1.0;
+            chirp_in[idx(i, j)] = std::polar(s, k * (x * x + y * y) / (2.0 * z));
+            chirp_out[idx(i, j)] = s * prefactor * std::polar(1.0, k * (x2 * x2 + y2 * y2) / (2.0 * z));
+        }
+    }
+
+    auto process_component = [&](FieldGrid &grid)
+    {
+        const FieldGrid::Rows &in = grid.read();
         for (int i = 0; i < N; ++i)
             for (int j = 0; j < N; ++j)
             {
                 int kidx = idx(i, j);
-                inp[kidx][0] = A[i][j].real();
-                inp[kidx][1] = A[i][j].imag();
+                std::complex<double> val = in[i][j] * chirp_in[kidx];
+                inp[kidx][0] = val.real();
+                inp[kidx][1] = val.imag();
             }
 
-        fftw_plan forward = fftw_plan_dft_2d(N, N, inp, out, FFTW_FORWARD, FFTW_ESTIMATE);
-        fftw_execute(forward);
-        fftw_destroy_plan(forward);
+        fftw_execute_dft(forward, inp, out);
 
-        for (int u = 0; u < N; ++u)
-        {
-            int uu = u - N / 2;
-            double fx = double(uu) / (N * dx);
-            for (int v = 0; v < N; ++v)
+        FieldGrid::Rows &A = grid.replace();
+        for (int i = 0; i < N; ++i)
+            for (int j = 0; j < N; ++j)
             {
-                int vv = v - N / 2;
-                double fy = double(vv) / (N * dx);
-                double H_phase = -PI * wavelength * z * (fx * fx + fy * fy);
-                std::complex<double> H = std::polar(1.0, H_phase);
+                int kidx = idx(i, j);
+                A[i][j] = std::complex<double>(out[kidx][0], out[kidx][1]) * chirp_out[kidx];
+            }
+    };
 
-                int kidx = idx(u, v);
-                std::complex<double> S(out[kidx][0], out[kidx][1]);
-                S *= H;
+    process_component(Ex);
+    process_component(Ey);
 
-                out[kidx][0] = S.real();
-                out[kidx][1] = S.imag();
-            }
+    pixel_size = dx_out;
+    size = N * dx_out;
+}
+
+// Chirp-z transform of every row of a rows x N array onto M outputs (Bluestein's algorithm):
+// out[r][m] = sum_n in[r][n] exp(-i 2 pi alpha (n - N/2)(m + shift))
+static PooledBuffer chirpZRows(const PooledBuffer &in, int rows, int N, int M, double alpha, double shift)
+{
+    const int L = nextFastFFTSize(N + M - 1);
+
+    std::vector<std::complex<double>> pre(N), post(M);
+    for (int n = 0; n < N; ++n)
+        pre[n] = std::polar(1.0, -PI * alpha * sq(n - N / 2));
+    for (int m = 0; m < M; ++m)
+        post[m] = std::polar(1.0, -PI * alpha * sq(m + shift)) / double(L);
+
+    PooledBuffer kernel_buf(L), work_buf((size_t)L * rows);
+    fftw_complex *kernel = kernel_buf.fftw();
+    fftw_complex *buf = work_buf.fftw();
+
+    // n*m = (n^2 + m^2 - (m - n)^2) / 2 turns the sum into a convolution with a chirp indexed by m - n
+    for (int d = 0; d < L; ++d)
+    {
+        double t = (d - (N - 1)) + N / 2 + shift;
+        std::complex<double> c = (d < N + M - 1) ? std::polar(1.0, PI * alpha * t * t) : 0.0;
+        kernel[d][0] = c.real();
+        kernel[d][1] = c.imag();
+    }
+    fftw_execute_dft(FftPlans::instance().get(1, L, 1, 1, L, FFTW_FORWARD, true), kernel, kernel);
+
+    fftw_plan forward = FftPlans::instance().get(1, L, rows, 1, L, FFTW_FORWARD, true);
+    fftw_plan inverse = FftPlans::instance().get(1, L, rows, 1, L, FFTW_BACKWARD, true);
+
+    for (int r = 0; r < rows; ++r)
+        for (int n = 0; n < L; ++n)
+        {
+            std::complex<double> val = (n < N) ? in[(size_t)r * N + n] * pre[n] : 0.0;
+            buf[(size_t)r * L + n][0] = val.real();
+            buf[(size_t)r * L + n][1] = val.imag();
+        }
+
+    fftw_execute_dft(forward, buf, buf);
+    for (int r = 0; r < rows; ++r)
+        for (int n = 0; n < L; ++n)
+        {
+            fftw_complex &x = buf[(size_t)r * L + n];
+            std::complex<double> val = std::complex<double>(x[0], x[1]) * std::complex<double>(kernel[n][0], kernel[n][1]);
+            x[0] = val.real();
+            x[1] = val.imag();
         }
+    fftw_execute_dft(inverse, buf, buf);
 
-        fftw_plan inverse = fftw_plan_dft_2d(N, N, out, inp, FFTW_BACKWARD, FFTW_ESTIMATE);
-        fftw_execute(inverse);
-        fftw_destroy_plan(inverse);
+    PooledBuffer out((size_t)rows * M);
+    for (int r = 0; r < rows; ++r)
+        for (int m = 0; m < M; ++m)
+        {
+            const fftw_complex &y = buf[(size_t)r * L + m + N - 1];
+            out[(size_t)r * M + m] = std::complex<double>(y[0], y[1]) * post[m];
+        }
+    return out;
+}
 
-        double norm = 1.0 / double(N * N);
+// Separable 2D chirp-z transform of count stacked N x N arrays onto Mi x Mj outputs each, output
+// (mi, mj) sitting at offsets (mi + shift_i, mj + shift_j) from the centre of the output grid. The
+// rows (then the columns) of every array go through one batched transform
+static PooledBuffer chirpZ2D(const PooledBuffer &in, int count, int N, int Mi, int Mj, double alpha, double shift_i, double shift_j)
+{
+    PooledBuffer rowsDone = chirpZRows(in, count * N, N, Mj, alpha, shift_j);
+
+    const size_t inSlice = (size_t)N * Mj, outSlice = (size_t)Mi * Mj;
+    PooledBuffer transposed(count * inSlice);
+    for (int c = 0; c < count; ++c)
         for (int i = 0; i < N; ++i)
-            for (int j = 0; j < N; ++j)
+            for (int j = 0; j < Mj; ++j)
+                transposed[c * inSlice + (size_t)j * N + i] = rowsDone[c * inSlice + (size_t)i * Mj + j];
+
+    PooledBuffer colsDone = chirpZRows(transposed, count * Mj, N, Mi, alpha, shift_i);
+
+    PooledBuffer out(count * outSlice);
+    for (int c = 0; c < count; ++c)
+        for (int j = 0; j < Mj; ++j)
+            for (int i = 0; i < Mi; ++i)
+                out[c * outSlice + (size_t)i * Mj + j] = colsDone[c * outSlice + (size_t)j * Mi + i];
+    return out;
+}
+
+void WaveFront::zoomPropagate(double z, WaveFront &target) const
+{
+    zoomPropagateGroup({this}, z, {&target});
+}
+
+// zoomPropagate for fields sharing a grid and a wavelength, each onto its own target (all on one
+// grid): the set-up is done once and the chirp-z transforms of every component run together
+void WaveFront::zoomPropagateGroup(const std::vector<const WaveFront *> &fields, double z, const std::vector<WaveFront *> &targets)
+{
+    const WaveFront &field = *fields[0], &target = *targets[0];
+    const int N = field.N;
+    const double pixel_size = field.pixel_size, wavelength = field.wavelength;
+    const ray &normal = field.normal;
+    const vec3 &u = field.u, &v = field.v;
+    const int M = target.N;
+    const double dx_in = pixel_size;
+    const double dx_out = target.pixel_size;
+    const double k = 2 * PI / wavelength;
+
+    // Offset of the target grid centre from the beam axis, in the grid's index directions
+    // (pixel (i, j) lies at (N/2 - i) * dx along u and (N/2 - j) * dx along v)
+    vec3 offset = target.normal.pos() - (normal.pos() + z * normal.dir());
+    const double ci = -dot(offset, u);
+    const double cj = -dot(offset, v);
+
+    const bool farField = field.fresnelNumber(z) < 1.0;
+
+    // Target pixels that can receive light. In the near field the angular spectrum is periodic,
+    // so only pixels within the field's support are evaluated and the input is padded until its
+    // periodic replicas cannot reach them
+    int i0 = 0, i1 = M, j0 = 0, j1 = M;
+    int n = N; // Length of the transformed input along each axis
+    if (!farField)
+    {
+        double sin_max = wavelength / (2.0 * dx_in);
+        double spread = (sin_max < 1.0) ? z * sin_max / std::sqrt(1.0 - sin_max * sin_max) : INF;
+        double support = 0.5 * N * dx_in + spread;
+
+        auto clip = [&](double c, int &m0, int &m1)
+        {
+            m0 = max(0, (int)std::floor((-support - c) / dx_out) + M / 2);
+            m1 = min(M, (int)std::ceil((support - c) / dx_out) + M / 2 + 1);
+        };
+        clip(ci, i0, i1);
+        clip(cj, j0, j1);
+        if (i0 >= i1 || j0 >= j1)
+            return;
+
+        double reach = 0.0;
+        for (double edge : {(i0 - M / 2) * dx_out + ci, (i1 - M / 2) * dx_out + ci, (j0 - M / 2) * dx_out + cj, (j1 - M / 2) * dx_out + cj})
+            reach = max(reach, std::abs(edge));
+        n = max(field.paddedSize(), nextFastFFTSize((int)std::ceil((min(reach, support) + support) / dx_in)));
+    }
+    const int Mi = i1 - i0, Mj = j1 - j0;
+
+    std::vector<std::complex<double>> pre_i(n), pre_j(n), post_i(Mi), post_j(Mj);
+    std::complex<double> prefactor;
+    double alpha;
+
+    if (farField)
+    {
+        // Fresnel integral evaluated directly on the target grid (scaled single-FFT Fresnel transform)
+        alpha = dx_in * dx_out / (wavelength * z);
+        for (int q = 0; q < n; ++q)
+        {
+            double x = (q - n / 2) * dx_in;
+            pre_i[q] = std::polar(1.0, k * x * x / (2.0 * z) - k * x * ci / z);
+            pre_j[q] = std::polar(1.0, k * x * x / (2.0 * z) - k * x * cj / z);
+        }
+        for (int m = 0; m < Mi; ++m)
+        {
+            double xi = ci + (m + i0 - M / 2) * dx_out;
+            post_i[m] = std::polar(1.0, k * xi * xi / (2.0 * z));
+        }
+        for (int m = 0; m < Mj; ++m)
+        {
+            double xj = cj + (m + j0 - M / 2) * dx_out;
+            post_j[m] = std::polar(1.0, k * xj * xj / (2.0 * z));
+        }
+        prefactor = std::polar(1.0, k * z) / std::complex<double>(0.0, wavelength * z) * (dx_in * dx_in);
+    }
+    else
+    {
+        // Angular spectrum step, with the inverse transform evaluated on the target grid; the
+        // (-1)^q factors undo the centring shift applied to the input before the forward FFT (the
+        // (-1)^(n/2) each axis leaves cancels between the two axes)
+        const double df = 1.0 / (n * dx_in);
+        alpha = -df * dx_out;
+        for (int q = 0; q < n; ++q)
+        {
+            double s = (q & 1) ? -1.0 : 1.0;
+            pre_i[q] = std::polar(s, 2 * PI * (q - n / 2) * df * ci);
+            pre_j[q] = std::polar(s, 2 * PI * (q - n / 2) * df * cj);
+        }
+        for (int m = 0; m < Mi; ++m)
+            post_i[m] = 1.0;
+        for (int m = 0; m < Mj; ++m)
+            post_j[m] = 1.0;
+        prefactor = 1.0 / (double(n) * n);
+    }
+
+    PooledBuffer H;
+    if (!farField)
+        H = field.transferFunction(z, true, n);
+
+    // Ex and Ey of every field, stacked
+    const int count = 2 * (int)fields.size();
+    const size_t slice = (size_t)n * n;
+    PooledBuffer in(count * slice);
+    for (int c = 0; c < count; ++c)
+    {
+        const WaveFront &f = *fields[c / 2];
+        const FieldGrid::Rows &A = (c & 1) ? f.Ey.read() : f.Ex.read();
+        std::complex<double> *slot = in.data() + c * slice;
+        if (farField)
+        {
+            for (int i = 0; i < N; ++i)
+                for (int j = 0; j < N; ++j)
+                    slot[i * N + j] = A[i][j] * pre_i[i] * pre_j[j];
+        }
+        else
+        {
+            PooledBuffer S = f.centredSpectrum(A, n);
+            for (int i = 0; i < n; ++i)
+                for (int j = 0; j < n; ++j)
+                    slot[i * n + j] = S[i * n + j] * H[i * n + j] * pre_i[i] * pre_j[j];
+        }
+    }
+
+    PooledBuffer out = chirpZ2D(in, count, n, Mi, Mj, alpha, i0 - M / 2, j0 - M / 2);
+
+    for (int c = 0; c < count; ++c)
+    {
+        WaveFront &t = *targets[c / 2];
+        FieldGrid::Rows &Aout = (c & 1) ? t.Ey.write() : t.Ex.write();
+        const std::complex<double> *result = out.data() + c * (size_t)Mi * Mj;
+        for (int i = 0; i < Mi; ++i)
+            for (int j = 0; j < Mj; ++j)
+                Aout[i + i0][j + j0] += prefactor * post_i[i] * post_j[j] * result[i * Mj + j];
+    }
+}
+
+BeamMoments WaveFront::moments() const
+{
+    // Intensity-weighted position and angle statistics (Siegman's second-moment beam description);
+    // angles come from central differences of the complex field, theta = lambda / (2 pi) * grad(phase)
+    BeamMoments m;
+    const double dx = pixel_size;
+    const double c = wavelength / (2 * PI);
+
+    double sx = 0, sy = 0, stx = 0, sty = 0, sxx = 0, syy = 0, sxt = 0, syt = 0, sttx = 0, stty = 0;
+
+    auto accumulate = [&](const std::vector<std::vector<std::complex<double>>> &A)
+    {
+        for (int i = 1; i < N - 1; i++)
+        {
+            double y = (i - N / 2) * dx;
+            for (int j = 1; j < N - 1; j++)
             {
-                int kidx = idx(i, j);
-                std::complex<double> val(inp[kidx][0] * norm, inp[kidx][1] * norm);
-                Aout[i][j] = val;
+                double x = (j - N / 2) * dx;
+                const std::complex<double> &E = A[i][j];
+                double I = std::norm(E);
+                std::complex<double> dEx = (A[i][j + 1] - A[i][j - 1]) / (2.0 * dx);
+                std::complex<double> dEy = (A[i + 1][j] - A[i - 1][j]) / (2.0 * dx);
+                double tx = c * std::imag(std::conj(E) * dEx); // I * theta_x
+                double ty = c * std::imag(std::conj(E) * dEy);
+
+                m.power += I;
+                sx += I * x;
+                sy += I * y;
+                sxx += I * x * x;
+                syy += I * y * y;
+                stx += tx;
+                sty += ty;
+                sxt += x * tx;
+                syt += y * ty;
+                sttx += c * c * std::norm(dEx);
+                stty += c * c * std::norm(dEy);
             }
+        }
     };
 
-    auto apply_shift = [&](std::vector<std::vector<std::complex<double>>> &A)
+    accumulate(Ex.read());
+    accumulate(Ey.read());
+
+    if (m.power <= 0.0)
+        return m;
+
+    m.cx = sx / m.power;
+    m.cy = sy / m.power;
+    m.tx = stx / m.power;
+    m.ty = sty / m.power;
+    m.xx = sxx / m.power - m.cx * m.cx;
+    m.yy = syy / m.power - m.cy * m.cy;
+    m.xt = sxt / m.power - m.cx * m.tx;
+    m.yt = syt / m.power - m.cy * m.ty;
+    m.ttx = sttx / m.power - m.tx * m.tx;
+    m.tty = stty / m.power - m.ty * m.ty;
+    m.power *= dx * dx;
+    return m;
+}
+
+void WaveFront::predictExtent(double z, double &half_width, double &max_angle) const
+{
+    const double window_sigmas = 6.0; // Half-width of the window, in standard deviations of the beam
+    const double band_sigmas = 6.0;   // Largest sampled angle, in standard deviations of the angular spectrum
+
+    BeamMoments m = moments();
+    if (m.power <= 0.0)
     {
-        for (int i = 0; i < N; ++i)
-            for (int j = 0; j < N; ++j)
-                A[i][j] *= std::complex<double>((((i + j) & 1) ? -1.0 : 1.0), 0.0);
-    };
+        half_width = 0.0;
+        max_angle = 0.0;
+        return;
+    }
 
-    std::vector<std::vector<std::complex<double>>> Ex_out(N, std::vector<std::complex<double>>(N));
-    std::vector<std::vector<std::complex<double>>> Ey_out(N, std::vector<std::complex<double>>(N));
+    // Free-space propagation keeps the angular spectrum and evolves the width quadratically in z
+    half_width = max(std::abs(m.cx + z * m.tx) + window_sigmas * std::sqrt(max(0.0, m.xx + 2 * z * m.xt + z * z * m.ttx)),
+                     std::abs(m.cy + z * m.ty) + window_sigmas * std::sqrt(max(0.0, m.yy + 2 * z * m.yt + z * z * m.tty)));
+    max_angle = max(std::abs(m.tx) + band_sigmas * std::sqrt(max(0.0, m.ttx)),
+                    std::abs(m.ty) + band_sigmas * std::sqrt(max(0.0, m.tty)));
+}
 
-    auto Ex_copy = Ex;
-    apply_shift(Ex_copy);
-    process_component(Ex_copy, Ex_out);
-    apply_shift(Ex_out);
+bool WaveFront::chooseSampling(double half_width, double max_angle, int max_N, double &new_pixel_size, int &new_N) const
+{
+    const int min_N = 64;
 
-    auto Ey_copy = Ey;
-    apply_shift(Ey_copy);
-    process_component(Ey_copy, Ey_out);
-    apply_shift(Ey_out);
+    if (half_width <= 0.0)
+        return false;
 
-    Ex.swap(Ex_out);
-    Ey.swap(Ey_out);
+    double dx = (max_angle > 0.0) ? wavelength / (2.0 * max_angle) : pixel_size;
+    int n = nextFastFFTSize(max(min_N, (int)std::ceil(2.0 * half_width / dx)));
+    if (n > max_N)
+    {
+        // Trade resolution for window rather than exceed the largest grid allowed
+        n = nextFastFFTSize(max_N);
+        dx = 2.0 * half_width / n;
+    }
+
+    if (n == N && std::abs(dx / pixel_size - 1.0) < 0.25)
+        return false;
 
-    fftw_free(inp);
-    fftw_free(out);
+    new_pixel_size = dx;
+    new_N = n;
+    return true;
+}
+
+void WaveFront::propagateResampled(double z, double new_pixel_size, int new_N)
+{
+    WaveFront target(normal, wavelength, source, psi, delta, w0, l, p, new_N * new_pixel_size, new_pixel_size);
+    target.method = method;
+    target.guard = guard;
+    target.normal.propagate(z);
+
+    zoomPropagate(z, target);
+    *this = std::move(target);
+}
+
+// propagateResampled for every field of the batch onto the same new grid. Fields on one grid with
+// one wavelength (the modes of a partially coherent source, say) share a single zoom step; the
+// in-flight work is about 2 * K * n^2 values for K such fields, n the padded input size
+void WaveFront::propagateResampledBatch(std::vector<WaveFront> &batch, double z, double new_pixel_size, int new_N)
+{
+    std::vector<bool> done(batch.size(), false);
+    for (size_t first = 0; first < batch.size(); first++)
+    {
+        if (done[first])
+            continue;
+
+        std::vector<size_t> group;
+        for (size_t m = first; m < batch.size(); m++)
+            if (!done[m] && batch[m].wavelength == batch[first].wavelength && batch[m].guard == batch[first].guard && batch[m].sameGrid(batch[first]))
+            {
+                group.push_back(m);
+                done[m] = true;
+            }
+
+        std::vector<const WaveFront *> fields;
+        std::vector<WaveFront> targets;
+        for (size_t m : group)
+        {
+            const WaveFront &field = batch[m];
+            targets.emplace_back(field.normal, field.wavelength, field.source, field.psi, field.delta, field.w0, field.l, field.p, new_N * new_pixel_size, new_pixel_size);
+            targets.back().method = field.method;
+            targets.back().guard = field.guard;
+            targets.back().normal.propagate(z);
+            fields.push_back(&field);
+        }
+        std::vector<WaveFront *> slots;
+        for (auto &target : targets)
+            slots.push_back(&target);
+
+        zoomPropagateGroup(fields, z, slots);
+        for (size_t k = 0; k < group.size(); k++)
+            batch[group[k]] = std::move(targets[k]);
+    }
 }
 
 void WaveFront::phaseShift(double phi)
 {
     ;
     std::complex<double> ph = std::polar(1.0, phi);
+    FieldGrid::Rows &ex = Ex.write(), &ey = Ey.write();
     for (int i = 0; i < N; i++)
         for (int j = 0; j < N; j++)
         {
-            Ex[i][j] *= ph;
-            Ey[i][j] *= ph;
+            ex[i][j] *= ph;
+            ey[i][j] *= ph;
         }
 }
 
 void WaveFront::scale(double factor)
 {
-    ;
+    if (factor == 0.0)
+    {
+        // Fresh zeroed grids; a shared field is left untouched without being copied first
+        Ex.assign(N);
+        Ey.assign(N);
+        return;
+    }
+
+    FieldGrid::Rows &ex = Ex.write(), &ey = Ey.write();
     for (int i = 0; i < N; i++)
         for (int j = 0; j < N; j++)
         {
-            Ex[i][j] *= factor;
-            Ey[i][j] *= factor;
+            ex[i][j] *= factor;
+            ey[i][j] *= factor;
         }
 }
 
@@ -166,157 +775,580 @@ std::vector<std::vector<double>> WaveFront::Phase() const
     return phase;
 }
 
+bool WaveFront::FieldKey::operator==(const FieldKey &other) const
+{
+    return source == other.source && psi == other.psi && delta == other.delta && wavelength == other.wavelength && w0 == other.w0 &&
+           l == other.l && p == other.p && N == other.N && pixel_size == other.pixel_size &&
+           dir.x() == other.dir.x() && dir.y() == other.dir.y() && dir.z() == other.dir.z();
+}
+
+WaveFront::FieldKey WaveFront::fieldKey() const
+{
+    vec3 dir = (source == FieldType::LG) ? normal.dir() : vec3(0.0, 0.0, 0.0);
+    return {source, psi, delta, wavelength, w0, l, p, N, pixel_size, dir};
+}
+
+bool WaveFront::initializeIfChanged()
+{
+    if (keyValid && fieldKey() == initializedKey)
+        return false;
+    initialize();
+    return true;
+}
+
+FieldStatistics WaveFront::sampleMaps(double *intensity, double *phase) const
+{
+    const FieldGrid::Rows &ex = Ex.read(), &ey = Ey.read();
+
+    // Per-row partial results, combined afterwards (min/max reductions are not portable OpenMP)
+    std::vector<double> row_min(N), row_max(N), row_power(N);
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++)
+    {
+        const std::complex<double> *ex_row = ex[i].data(), *ey_row = ey[i].data();
+        double lo = INF, hi = -INF, power = 0.0;
+        for (int j = 0; j < N; j++)
+        {
+            double px = std::norm(ex_row[j]), py = std::norm(ey_row[j]);
+            double I = px * px + py * py;
+            lo = min(lo, I);
+            hi = max(hi, I);
+            power += px + py;
+            if (intensity)
+                intensity[i * N + j] = I;
+            if (phase)
+                phase[i * N + j] = std::arg(ex_row[j]);
+        }
+        row_min[i] = lo;
+        row_max[i] = hi;
+        row_power[i] = power;
+    }
+
+    FieldStatistics stats;
+    if (N <= 0)
+        return stats;
+
+    stats.minIntensity = row_min[0];
+    stats.maxIntensity = row_max[0];
+    for (int i = 0; i < N; i++)
+    {
+        stats.minIntensity = min(stats.minIntensity, row_min[i]);
+        stats.maxIntensity = max(stats.maxIntensity, row_max[i]);
+        stats.power += row_power[i];
+    }
+    stats.power *= pixel_size * pixel_size;
+    return stats;
+}
+
 void WaveFront::initialize()
 {
-    double k = 2 * PI / wavelength;
-    double half = size / 2.0;
+    FieldGrid::Rows &ex = Ex.replace(), &ey = Ey.replace();
 
     for (int i = 0; i < N; i++)
     {
         double y = (i - N / 2) * pixel_size;
         for (int j = 0; j < N; j++)
-        {
-            double x = (j - N / 2) * pixel_size;
-            std::complex<double> comp_amp(0.0, 0.0);
-            double norm = sqrt(2.0 / (PI * w0 * w0));
+            fieldAt((j - N / 2) * pixel_size, y, ex[i][j], ey[i][j]);
+    }
 
-            switch (source)
-            {
-            case FieldType::PLANE:
-            {
-                comp_amp = std::polar(1.0, 0.0);
-                break;
-            }
+    initializedKey = fieldKey();
+    keyValid = true;
+}
 
-            case FieldType::GAUSSIAN:
-            {
-                double r2 = x * x + y * y;
-                double amp = norm * exp(-r2 / (w0 * w0));
-                comp_amp = std::complex<double>(amp, 0.0);
-                break;
-            }
+void WaveFront::fieldAt(double x, double y, std::complex<double> &ex, std::complex<double> &ey) const
+{
+    double k = 2 * PI / wavelength;
+    std::complex<double> comp_amp(0.0, 0.0);
+    double norm = sqrt(2.0 / (PI * w0 * w0));
 
-            case FieldType::LG:
-            {
-                double r = sqrt(x * x + y * y);
-                double phi = atan2(y, x);
-                double rho = sqrt(2.0) * r / w0;
-                double L = genLaguerre(p, std::abs(l), rho * rho);
-                double amp = L * pow(rho, std::abs(l)) * exp(-rho * rho / 2.0);
+    switch (source)
+    {
+    case FieldType::PLANE:
+    {
+        comp_amp = std::polar(1.0, 0.0);
+        break;
+    }
 
-                double norm = sqrt(2.0 * factorial(p) / (PI * factorial(p + std::abs(l)))) / w0;
+    case FieldType::GAUSSIAN:
+    {
+        double r2 = x * x + y * y;
+        double amp = norm * exp(-r2 / (w0 * w0));
+        comp_amp = std::complex<double>(amp, 0.0);
+        break;
+    }
 
-                amp *= norm;
+    case FieldType::LG:
+    {
+        double r = sqrt(x * x + y * y);
+        double phi = atan2(y, x);
+        double rho = sqrt(2.0) * r / w0;
+        double L = genLaguerre(p, std::abs(l), rho * rho);
+        double amp = L * pow(rho, std::abs(l)) * exp(-rho * rho / 2.0);
 
-                double phase = l * phi + k * dot(normal.dir(), vec3(x, y, 0.0));
+        double norm = sqrt(2.0 * factorial(p) / (PI * factorial(p + std::abs(l)))) / w0;
 
-                comp_amp = std::polar(amp, phase);
-                break;
-            }
+        amp *= norm;
 
-            case FieldType::HG:
-            {
-                double X = sqrt(2.0) * x / w0;
-                double Y = sqrt(2.0) * y / w0;
-                double Hm = hermitePol(l, X);
-                double Hn = hermitePol(p, Y);
-                comp_amp = std::complex<double>(norm * Hm * Hn * exp(-(x * x + y * y) / (w0 * w0)), 0.0);
-                break;
-            }
+        double phase = l * phi + k * dot(normal.dir(), vec3(x, y, 0.0));
 
-            case FieldType::BLANK:
-            {
-                comp_amp = std::complex<double>(0.0, 0.0);
-                break;
-            }
-            }
+        comp_amp = std::polar(amp, phase);
+        break;
+    }
 
-            Ex[i][j] = comp_amp * std::cos(psi);
-            Ey[i][j] = comp_amp * std::polar(1.0, delta) * std::sin(psi);
-        }
+    case FieldType::HG:
+    {
+        // H_l(X) H_p(Y) exp(-(x^2 + y^2) / w0^2), its polynomial scale applied in the log domain
+        double X = sqrt(2.0) * x / w0;
+        double Y = sqrt(2.0) * y / w0;
+        double scale = exp(0.5 * (hermiteLogNorm(l) + hermiteLogNorm(p)));
+        comp_amp = std::complex<double>(norm * scale * hermiteFunction(l, X) * hermiteFunction(p, Y), 0.0);
+        break;
     }
+
+    case FieldType::BLANK:
+    {
+        comp_amp = std::complex<double>(0.0, 0.0);
+        break;
+    }
+    }
+
+    ex = comp_amp * std::cos(psi);
+    ey = comp_amp * std::polar(1.0, delta) * std::sin(psi);
 }
 
 // Operators
-WaveFront WaveFront::operator+(const WaveFront &other)
+WaveFront::WaveFront(const FieldSum &sum)
+    : WaveFront(*sum.getTerms().front().field)
+{
+    evaluate(sum, false);
+}
+
+bool WaveFront::sameGrid(const WaveFront &other) const
+{
+    const double tol = 1e-9;
+    return N == other.N && std::abs(pixel_size - other.pixel_size) <= tol * pixel_size &&
+           (normal.pos() - other.normal.pos()).length() <= tol * pixel_size &&
+           dot(u, other.u) > 1.0 - tol && dot(v, other.v) > 1.0 - tol && dot(w, other.w) > 1.0 - tol;
+}
+
+// Terms sharing this grid are combined in a single pass over the pixels; the rest are resampled
+// onto it afterwards
+void WaveFront::evaluate(const FieldSum &sum, bool add)
 {
-    WaveFront C(this->getNormal(), this->getWavelength(), this->source, this->psi, this->delta, this->w0, this->l, this->p, this->getSize(), this->getPixelSize());
-    for (int i = 0; i < C.N; i++)
-        for (int j = 0; j < C.N; j++)
+    std::vector<FieldSum::Term> direct, resampled;
+    for (const FieldSum::Term &term : sum.getTerms())
+        (sameGrid(*term.field) ? direct : resampled).push_back(term);
+
+    // A term that aliases this grid but has to be resampled would read pixels already overwritten
+    for (const FieldSum::Term &term : resampled)
+        if (term.field == this)
         {
-            C.Ex[i][j] = this->Ex[i][j] + other.Ex[i][j];
-            C.Ey[i][j] = this->Ey[i][j] + other.Ey[i][j];
+            WaveFront result(sum);
+            if (add)
+                accumulate(result, 1.0);
+            else
+                *this = std::move(result);
+            return;
         }
-    return C;
+
+    const size_t terms = direct.size();
+    FieldGrid::Rows &ex_out = Ex.write(), &ey_out = Ey.write(); // Detach before the parallel loop
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++)
+        {
+            std::complex<double> ex = add ? ex_out[i][j] : 0.0, ey = add ? ey_out[i][j] : 0.0;
+            for (size_t t = 0; t < terms; t++)
+            {
+                ex += direct[t].coefficient * direct[t].field->Ex.read()[i][j];
+                ey += direct[t].coefficient * direct[t].field->Ey.read()[i][j];
+            }
+            ex_out[i][j] = ex;
+            ey_out[i][j] = ey;
+        }
+
+    for (const FieldSum::Term &term : resampled)
+        accumulate(*term.field, term.coefficient);
+}
+
+WaveFront &WaveFront::operator=(const FieldSum &sum)
+{
+    const WaveFront &first = *sum.getTerms().front().field;
+    if (!sameGrid(first))
+    {
+        *this = WaveFront(sum);
+        return *this;
+    }
+    evaluate(sum, false);
+    return *this;
+}
+
+WaveFront &WaveFront::operator+=(const FieldSum &sum)
+{
+    evaluate(sum, true);
+    return *this;
 }
 
-WaveFront WaveFront::operator-(const WaveFront &other)
+WaveFront &WaveFront::operator+=(const WaveFront &other)
+{
+    accumulate(other, 1.0);
+    return *this;
+}
+
+WaveFront &WaveFront::operator-=(const WaveFront &other)
 {
-    WaveFront C(this->getNormal(), this->getWavelength(), this->source, this->psi, this->delta, this->w0, this->l, this->p, this->getSize(), this->getPixelSize());
-    for (int i = 0; i < C.N; i++)
-        for (int j = 0; j < C.N; j++)
+    accumulate(other, -1.0);
+    return *this;
+}
+
+// Bilinear sample of a grid at fractional indices; samples outside the grid are zero
+static std::complex<double> bilinear(const std::vector<std::vector<std::complex<double>>> &F, int N, double fi, double fj)
+{
+    int i0 = (int)std::floor(fi);
+    int j0 = (int)std::floor(fj);
+    double ti = fi - i0;
+    double tj = fj - j0;
+
+    std::complex<double> value(0.0, 0.0);
+    for (int di = 0; di < 2; di++)
+    {
+        int i = i0 + di;
+        if (i < 0 || i >= N)
+            continue;
+        double wi = di ? ti : 1.0 - ti;
+        for (int dj = 0; dj < 2; dj++)
         {
-            C.Ex[i][j] = this->Ex[i][j] - other.Ex[i][j];
-            C.Ey[i][j] = this->Ey[i][j] - other.Ey[i][j];
+            int j = j0 + dj;
+            if (j < 0 || j >= N)
+                continue;
+            value += F[i][j] * (wi * (dj ? tj : 1.0 - tj));
         }
-    return C;
+    }
+    return value;
 }
 
-WaveFront &WaveFront::operator+=(const WaveFront &other)
+void WaveFront::accumulate(const WaveFront &other, double coefficient)
 {
+    // Gather form: each pixel of this grid is traced back along the other field's normal onto its
+    // plane and interpolated there. The plane-to-plane map is affine, so the source indices and the
+    // path length advance by constant steps along rows and columns of this grid
     const double k = 2.0 * PI / other.wavelength;
+    const vec3 other_normal = other.w;
+
+    if (std::abs(dot(other_normal, this->w)) < 1e-6)
+        return; // Edge-on planes exchange no light
 
-    vec3 this_center = this->normal.pos();
-    vec3 this_normal = this->w;
-    vec3 other_center = other.normal.pos();
-    vec3 other_normal = other.w;
+    // Detach this grid before the parallel loops (other may be this, so read it afterwards)
+    FieldGrid::Rows &ex_out = this->Ex.write(), &ey_out = this->Ey.write();
+    const FieldGrid::Rows &ex_in = other.Ex.read(), &ey_in = other.Ey.read();
 
-    double denominator = dot(other_normal, this_normal);
+    const vec3 corner = this->normal.pos() - other.normal.pos() + (this->N / 2.0) * this->pixel_size * (this->u + this->v);
+    const vec3 step_i = -this->pixel_size * this->u;
+    const vec3 step_j = -this->pixel_size * this->v;
 
-    for (int i = 0; i < other.N; i++)
+    // Source index = origin + di * i + dj * j, likewise for the path length d
+    const double is0 = other.N / 2.0 - dot(corner, other.u) / other.pixel_size;
+    const double is_di = -dot(step_i, other.u) / other.pixel_size;
+    const double is_dj = -dot(step_j, other.u) / other.pixel_size;
+    const double js0 = other.N / 2.0 - dot(corner, other.v) / other.pixel_size;
+    const double js_di = -dot(step_i, other.v) / other.pixel_size;
+    const double js_dj = -dot(step_j, other.v) / other.pixel_size;
+    const double d0 = dot(corner, other_normal);
+    const double d_di = dot(step_i, other_normal);
+    const double d_dj = dot(step_j, other_normal);
+
+    const double tol = 1e-9;
+    bool aligned = std::abs(is_di - 1.0) < tol && std::abs(is_dj) < tol && std::abs(js_di) < tol && std::abs(js_dj - 1.0) < tol &&
+                   std::abs(is0 - std::round(is0)) < tol && std::abs(js0 - std::round(js0)) < tol &&
+                   std::abs(d_di) < tol && std::abs(d_dj) < tol;
+
+    if (aligned)
     {
-        for (int j = 0; j < other.N; j++)
+        // Same pitch, parallel planes and a whole-pixel offset: a shifted row copy
+        const int oi = (int)std::lround(is0);
+        const int oj = (int)std::lround(js0);
+        const std::complex<double> phase = std::polar(coefficient, k * d0);
+        const int j_begin = max(0, -oj);
+        const int j_end = min(this->N, other.N - oj);
+
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < this->N; i++)
         {
-            vec3 SourcePixelPosition = other_center + (other.N / 2.0 - i) * other.pixel_size * other.u + (other.N / 2.0 - j) * other.pixel_size * other.v;
-            double DistanceToThisPlane = 0.0;
-            if (std::abs(denominator) >= 1e-6)
-                DistanceToThisPlane = dot(this_center - SourcePixelPosition, this_normal) / denominator;
-            SourcePixelPosition += DistanceToThisPlane * other_normal;
+            int i_src = i + oi;
+            if (i_src < 0 || i_src >= other.N)
+                continue;
+            const std::complex<double> *ex = ex_in[i_src].data() + oj;
+            const std::complex<double> *ey = ey_in[i_src].data() + oj;
+            for (int j = j_begin; j < j_end; j++)
+            {
+                ex_out[i][j] += ex[j] * phase;
+                ey_out[i][j] += ey[j] * phase;
+            }
+        }
+        return;
+    }
 
-            auto iThisDouble = this->N / 2.0 - dot(SourcePixelPosition - this_center, this->u) / this->pixel_size;
-            auto jThisDouble = this->N / 2.0 - dot(SourcePixelPosition - this_center, this->v) / this->pixel_size;
+    const std::complex<double> phase_step = std::polar(1.0, k * d_dj);
 
-            int iThis = (int)iThisDouble;
-            int jThis = (int)jThisDouble;
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < this->N; i++)
+    {
+        double is = is0 + is_di * i;
+        double js = js0 + js_di * i;
+        std::complex<double> phase = std::polar(coefficient, k * (d0 + d_di * i));
+        for (int j = 0; j < this->N; j++, is += is_dj, js += js_dj, phase *= phase_step)
+        {
+            if (is <= -1.0 || is >= other.N || js <= -1.0 || js >= other.N)
+                continue;
 
-            if (iThis >= 0 && iThis < this->N && jThis >= 0 && jThis < this->N)
+            int i0 = (int)std::floor(is);
+            int j0 = (int)std::floor(js);
+            if (i0 < 0 || i0 >= other.N - 1 || j0 < 0 || j0 >= other.N - 1)
             {
-                std::complex<double> PhaseFactor = std::polar(1.0, k * DistanceToThisPlane);
-                this->Ex[iThis][jThis] += other.Ex[i][j] * PhaseFactor;
-                this->Ey[iThis][jThis] += other.Ey[i][j] * PhaseFactor;
+                ex_out[i][j] += bilinear(ex_in, other.N, is, js) * phase;
+                ey_out[i][j] += bilinear(ey_in, other.N, is, js) * phase;
+                continue;
             }
+
+            // Interior: all four neighbours exist, weights shared by both components
+            double ti = is - i0, tj = js - j0;
+            double w00 = (1.0 - ti) * (1.0 - tj), w01 = (1.0 - ti) * tj, w10 = ti * (1.0 - tj), w11 = ti * tj;
+            const auto &ex0 = ex_in[i0], &ex1 = ex_in[i0 + 1];
+            const auto &ey0 = ey_in[i0], &ey1 = ey_in[i0 + 1];
+            ex_out[i][j] += (ex0[j0] * w00 + ex0[j0 + 1] * w01 + ex1[j0] * w10 + ex1[j0 + 1] * w11) * phase;
+            ey_out[i][j] += (ey0[j0] * w00 + ey0[j0 + 1] * w01 + ey1[j0] * w10 + ey1[j0 + 1] * w11) * phase;
         }
     }
-
-    return *this;
 }
 
-WaveFront &WaveFront::operator-=(const WaveFront &other)
+// accumulate() with the source rows held in pieces: every bilinear tap is taken from the slab
+// only if its row is there, so the slabs of a field, added one after another, sum to the whole
+// field's resampling. Each row of this grid visits only the columns whose taps can fall in the
+// slab, which keeps adding a field block by block linear in its size
+WaveFront &WaveFront::operator+=(const FieldSlab &rows)
 {
+    const vec3 other_normal = cross(rows.v, rows.u);
+    if (std::abs(dot(other_normal, this->w)) < 1e-6 || rows.count() == 0)
+        return *this;
+
+    const double k = 2.0 * PI / rows.wavelength;
+    const int first = rows.first, last = rows.first + rows.count(); // Rows [first, last) are held
+    FieldGrid::Rows &ex_out = this->Ex.write(), &ey_out = this->Ey.write();
+
+    const vec3 corner = this->normal.pos() - rows.origin + (this->N / 2.0) * this->pixel_size * (this->u + this->v);
+    const vec3 step_i = -this->pixel_size * this->u;
+    const vec3 step_j = -this->pixel_size * this->v;
+
+    const double is0 = rows.centre - dot(corner, rows.u) / rows.pixel_size;
+    const double is_di = -dot(step_i, rows.u) / rows.pixel_size;
+    const double is_dj = -dot(step_j, rows.u) / rows.pixel_size;
+    const double js0 = rows.centre - dot(corner, rows.v) / rows.pixel_size;
+    const double js_di = -dot(step_i, rows.v) / rows.pixel_size;
+    const double js_dj = -dot(step_j, rows.v) / rows.pixel_size;
+    const double d0 = dot(corner, other_normal);
+    const double d_di = dot(step_i, other_normal);
+    const double d_dj = dot(step_j, other_normal);
+
+#pragma omp parallel for schedule(static)
     for (int i = 0; i < this->N; i++)
-        for (int j = 0; j < this->N; j++)
+    {
+        // Columns where first - 1 < is < last, the rows whose taps the slab holds
+        const double a = is0 + is_di * i;
+        int j_begin = 0, j_end = this->N;
+        if (std::abs(is_dj) > 1e-12)
+        {
+            double lo = (first - 1 - a) / is_dj, hi = (last - a) / is_dj;
+            if (lo > hi)
+                std::swap(lo, hi);
+            const double begin = std::floor(lo), end = std::ceil(hi) + 1.0; // Evaluated once: min and max are macros
+            j_begin = (int)min((double)this->N, max(0.0, begin));
+            j_end = (int)min((double)this->N, max(0.0, end));
+        }
+        else if (a <= first - 1 || a >= last)
+            continue;
+
+        double is = a + is_dj * j_begin;
+        double js = js0 + js_di * i + js_dj * j_begin;
+        std::complex<double> phase = std::polar(1.0, k * (d0 + d_di * i + d_dj * j_begin));
+        const std::complex<double> phase_step = std::polar(1.0, k * d_dj);
+        for (int j = j_begin; j < j_end; j++, is += is_dj, js += js_dj, phase *= phase_step)
         {
-            this->Ex[i][j] -= other.Ex[i][j];
-            this->Ey[i][j] -= other.Ey[i][j];
+            if (is <= first - 1 || is >= last || js <= -1.0 || js >= rows.n)
+                continue;
+
+            const int i0 = (int)std::floor(is), j0 = (int)std::floor(js);
+            const double ti = is - i0, tj = js - j0;
+            std::complex<double> x(0.0, 0.0), y(0.0, 0.0);
+            for (int di = 0; di < 2; di++)
+            {
+                const int r = i0 + di;
+                if (r < first || r >= last)
+                    continue;
+                const std::complex<double> *ex = rows.ex[r - first], *ey = rows.ey[r - first];
+                const double wi = di ? ti : 1.0 - ti;
+                if (j0 >= 0)
+                {
+                    x += ex[j0] * (wi * (1.0 - tj));
+                    y += ey[j0] * (wi * (1.0 - tj));
+                }
+                if (j0 + 1 < rows.n)
+                {
+                    x += ex[j0 + 1] * (wi * tj);
+                    y += ey[j0 + 1] * (wi * tj);
+                }
+            }
+            ex_out[i][j] += x * phase;
+            ey_out[i][j] += y * phase;
         }
+    }
     return *this;
 }
 
 // Reflection
 void WaveFront::reflect(vec3 n)
 {
+    // The reflected field on the plane normal to the new axis is the mirror image of the incident
+    // one: gather it through the incident grid with its frame reflected about the mirror
+    n = unit_vector(n);
+    auto mirrored = [&](const vec3 &a) { return a - 2.0 * dot(a, n) * n; };
+
+    const ray incident_axis = normal;
+    const vec3 old_u = u, old_v = v, old_w = w;
     normal.reflect(n);
     get_LocalFrame();
+
+    // A fold about one of the grid axes (any mirror tilted in the plane of the beam) maps rows to
+    // rows and columns to columns, at most reversing their order: done in place. On an even grid
+    // the reversed pixels sit one pitch off their places, so the grid centre moves along with them
+    const double su = dot(mirrored(u), old_u), sv = dot(mirrored(v), old_v);
+    if (std::abs(su) > 1.0 - 1e-12 && std::abs(sv) > 1.0 - 1e-12)
+    {
+        const double shift = (N % 2 == 0) ? pixel_size : 0.0;
+        for (FieldGrid *grid : {&Ex, &Ey})
+        {
+            FieldGrid::Rows &A = grid->write();
+            if (su < 0.0)
+                std::reverse(A.begin(), A.end());
+            if (sv < 0.0)
+                for (auto &row : A)
+                    std::reverse(row.begin(), row.end());
+        }
+        setPosition(normal.pos() - (su < 0.0 ? shift : 0.0) * u - (sv < 0.0 ? shift : 0.0) * v);
+        return;
+    }
+
+    WaveFront incident = *this;
+    incident.normal = incident_axis;
+    incident.u = mirrored(old_u);
+    incident.v = mirrored(old_v);
+    incident.w = mirrored(old_w);
+
+    scale(0.0);
+    *this += incident;
+}
+
+// Rotation of the angular spectrum (Matsushima, 2003): each plane wave of the field is re-expressed
+// in the frame of the tilted plane and the spectrum is resampled there. The strong linear phase a
+// tilted plane sees is taken out of the resampling as a carrier and applied to the samples at the end
+void WaveFront::rotatePlane(vec3 dir)
+{
+    dir = unit_vector(dir);
+    if (dot(dir, w) > 1.0 - 1e-12)
+        return;
+
+    const int n = paddedSize();
+    const int pad = (n - N) / 2;
+    const double df = 1.0 / (n * pixel_size);
+    const double inv_lambda2 = 1.0 / (wavelength * wavelength);
+
+    // Frame of the tilted plane, as set up by get_LocalFrame
+    const vec3 old_u = u, old_v = v, old_w = w;
+    setDirection(dir);
+
+    // Grid frequencies are along -v (columns) and -u (rows); the old axis is the carrier
+    const double carrier_x = -dot(old_w, v) / wavelength;
+    const double carrier_y = -dot(old_w, u) / wavelength;
+
+    // Where each output frequency samples the old spectrum, and the Jacobian weight
+    std::vector<double> src_row(n * n), src_col(n * n), weight(n * n, 0.0);
+    for (int a = 0; a < n; ++a)
+    {
+        double fy = carrier_y + (a - n / 2) * df;
+        for (int b = 0; b < n; ++b)
+        {
+            double fx = carrier_x + (b - n / 2) * df;
+            double fw2 = inv_lambda2 - fx * fx - fy * fy;
+            if (fw2 <= 0.0)
+                continue;
+
+            vec3 K = -fx * v - fy * u + std::sqrt(fw2) * w;
+            double fw_old = dot(K, old_w);
+            if (fw_old <= 0.0)
+                continue;
+
+            src_row[a * n + b] = -dot(K, old_u) / df + n / 2;
+            src_col[a * n + b] = -dot(K, old_v) / df + n / 2;
+            weight[a * n + b] = fw_old / std::sqrt(fw2);
+        }
+    }
+
+    PooledBuffer work(n * n);
+    fftw_complex *buf = work.fftw();
+    fftw_plan inverse = FftPlans::instance().get2D(n, FFTW_BACKWARD, true);
+
+    auto process_component = [&](FieldGrid &grid)
+    {
+        // The FFT phase origin is the grid corner: (-1)^(row + col) moves it to the centre, where
+        // the spectrum is smooth enough to interpolate
+        PooledBuffer S = centredSpectrum(grid.read(), n);
+        for (int kidx = 0; kidx < n * n; ++kidx)
+            if ((kidx / n + kidx % n) & 1)
+                S[kidx] = -S[kidx];
+
+        for (int kidx = 0; kidx < n * n; ++kidx)
+        {
+            std::complex<double> value(0.0, 0.0);
+            if (weight[kidx] > 0.0)
+            {
+                // Bilinear interpolation of the old spectrum
+                double r = src_row[kidx], c = src_col[kidx];
+                int r0 = (int)std::floor(r), c0 = (int)std::floor(c);
+                double tr = r - r0, tc = c - c0;
+                for (int dr = 0; dr < 2; ++dr)
+                    for (int dc = 0; dc < 2; ++dc)
+                    {
+                        int rr = r0 + dr, cc = c0 + dc;
+                        if (rr < 0 || rr >= n || cc < 0 || cc >= n)
+                            continue;
+                        value += S[rr * n + cc] * ((dr ? tr : 1.0 - tr) * (dc ? tc : 1.0 - tc));
+                    }
+                value *= ((kidx / n + kidx % n) & 1) ? -weight[kidx] : weight[kidx];
+            }
+            buf[kidx][0] = value.real();
+            buf[kidx][1] = value.imag();
+        }
+
+        fftw_execute_dft(inverse, buf, buf);
+
+        FieldGrid::Rows &A = grid.replace();
+        double norm = 1.0 / (double(n) * n);
+        for (int i = 0; i < N; ++i)
+        {
+            double y = (i - N / 2) * pixel_size;
+            for (int j = 0; j < N; ++j)
+            {
+                double x = (j - N / 2) * pixel_size;
+                int kidx = (i + pad) * n + (j + pad);
+                double s = ((i + j) & 1) ? -norm : norm;
+                A[i][j] = std::complex<double>(s * buf[kidx][0], s * buf[kidx][1]) * std::polar(1.0, 2 * PI * (carrier_x * x + carrier_y * y));
+            }
+        }
+    };
+
+    process_component(Ex);
+    process_component(Ey);
 }
 
 void WaveFront::setDirection(vec3 dir)
@@ -332,8 +1364,26 @@ void WaveFront::setBeamMode(int L, int P)
 }
 
 void WaveFront::setPosition(vec3 pos) { normal = ray(pos, normal.dir()); }
-void WaveFront::setSize(double s) { size = s; }
-void WaveFront::setPixelSize(double px) { pixel_size = px; }
+void WaveFront::setSize(double s)
+{
+    size = s;
+    resizeGrid();
+}
+
+void WaveFront::setPixelSize(double px)
+{
+    pixel_size = px;
+    resizeGrid();
+}
+
+void WaveFront::setGrid(double s, double px)
+{
+    size = s;
+    pixel_size = px;
+    resizeGrid();
+}
+
+void WaveFront::setGuardFactor(double g) { guard = max(1.0, g); }
 void WaveFront::setWavelength(double w) { wavelength = w; }
 void WaveFront::setFieldType(FieldType type) { source = type; }
 void WaveFront::setPsi(double theta) { psi = theta; }
@@ -0,0 +1,26 @@
+#ifndef CHECK_HPP
+#define CHECK_HPP
+
+#pragma once
+
+#include <iostream>
+
+// Assertion of the test executables: reports a failed condition and carries on, so one run shows
+// every failure. main returns failures() as its exit code
+inline int &failures()
+{
+    static int count = 0;
+    return count;
+}
+
+#define CHECK(condition)                                                                          \
+    do                                                                                            \
+    {                                                                                             \
+        if (!(condition))                                                                         \
+        {                                                                                         \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            failures()++;                                                                         \
+        }                                                                                         \
+    } while (0)
+
+#endif
@@ -0,0 +1,99 @@
+// ElementBVH::closestHit against a linear scan of hit() over random layouts, before and after
+// update() refits moved, turned and resized elements and after it rebuilds for a new list
+#include <random>
+#include <vector>
+#include "check.hpp"
+#include "aperture.hpp"
+#include "element_bvh.hpp"
+#include "mirror.hpp"
+#include "scene.hpp"
+
+// What closestHit replaces: the nearest hit() that is not -999.0
+static int linearHit(const std::vector<OpticalElement *> &elements, const ray &beamlet, double &dist, int skip, const std::vector<char> &excluded)
+{
+    int best = -1;
+    dist = INF;
+    for (int e = 0; e < (int)elements.size(); e++)
+    {
+        if (e == skip || excluded[e])
+            continue;
+        double t = elements[e]->hit(beamlet);
+        if (t != -999.0 && t < dist)
+        {
+            dist = t;
+            best = e;
+        }
+    }
+    return best;
+}
+
+// Rays from inside the layout in random directions; returns the number of mismatches
+static int compare(const ElementBVH &bvh, const std::vector<OpticalElement *> &elements, std::mt19937 &rng, int &hits)
+{
+    std::uniform_real_distribution<double> U(-1.0, 1.0);
+    std::vector<char> excluded(elements.size(), 0);
+    for (auto &flag : excluded)
+        flag = rng() % 5 == 0;
+
+    int mismatches = 0;
+    hits = 0;
+    for (int r = 0; r < 20000; r++)
+    {
+        ray beamlet(vec3(0.3 * U(rng), 0.3 * U(rng), 0.3 * U(rng)), unit_vector(vec3(U(rng), U(rng), U(rng))));
+        const int skip = r % 3 == 0 ? (int)(rng() % elements.size()) : -1;
+        double fast, slow;
+        const int found = bvh.closestHit(beamlet, fast, skip, &excluded);
+        const int expected = linearHit(elements, beamlet, slow, skip, excluded);
+        if (expected >= 0)
+            hits++;
+        // Two elements at the same distance may come back in either order
+        if (found != expected && !(found >= 0 && expected >= 0 && fast == slow))
+            mismatches++;
+    }
+    return mismatches;
+}
+
+int main()
+{
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> U(-1.0, 1.0);
+    const char *kinds[] = {"ConvexLens", "ConcaveLens", "Iris", "Mirror", "Slit"};
+
+    for (int layout = 0; layout < 3; layout++)
+    {
+        Scene scene;
+        const int count = 20 + 150 * layout;
+        for (int k = 0; k < count; k++)
+            scene.AddObject(kinds[k % 5], vec3(0.5 * U(rng), 0.5 * U(rng), 0.5 * U(rng)), vec3(U(rng), U(rng), U(rng)));
+        std::vector<OpticalElement *> elements = scene.GetSimulationElements();
+
+        ElementBVH bvh;
+        bvh.update(elements);
+        int hits;
+        CHECK(compare(bvh, elements, rng, hits) == 0);
+        CHECK(hits > 0);
+
+        // Refit: a third of the elements move, turn or grow
+        for (auto element : elements)
+        {
+            if (rng() % 3 != 0)
+                continue;
+            element->setPosition(element->getPosition() + vec3(0.2 * U(rng), 0.2 * U(rng), 0.2 * U(rng)));
+            if (rng() % 2 == 0)
+                element->setOrientation(vec3(U(rng), U(rng), U(rng)));
+            if (auto mirror = dynamic_cast<Mirror *>(element))
+                mirror->setSize(0.01 + 0.05 * (U(rng) + 1.0));
+            if (auto iris = dynamic_cast<Iris *>(element))
+                iris->setSize(0.01 + 0.05 * (U(rng) + 1.0));
+        }
+        bvh.update(elements);
+        CHECK(compare(bvh, elements, rng, hits) == 0);
+
+        // Rebuild: half the elements leave
+        elements.resize(elements.size() / 2);
+        bvh.update(elements);
+        CHECK(bvh.size() == elements.size());
+        CHECK(compare(bvh, elements, rng, hits) == 0);
+    }
+    return failures();
+}
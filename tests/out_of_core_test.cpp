@@ -0,0 +1,95 @@
+// OutOfCoreSimulation against SimulationEngine on small fields, with a work buffer small enough that
+// every step streams several blocks, and the scenes an out-of-core run has to refuse
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include "check.hpp"
+#include "out_of_core_wavefront.hpp"
+#include "serialization.hpp"
+#include "simulation_engine.hpp"
+#include "utils.hpp"
+
+static const int SAMPLES = 128;
+
+static const char *SCENE =
+    "Settings adaptive=0 analytic=0\n"
+    "Source 0 0 0 0 0 1 field=lg l=1 p=1 waist=1.5e-3 guard=%s\n"
+    "ConvexLens 0 0 0.05 0 0 1 focal=0.3 diameter=0.012\n"
+    "Slit 0 0 0.08 0 0 1 width=0.004 height=0.01\n"
+    "%s\n";
+
+// Reads text and puts every source on a SAMPLES x SAMPLES grid of the same size
+static bool read(const std::string &text, Scene &scene, SimulationSettings &settings, std::string &error)
+{
+    std::istringstream in(text);
+    if (!ReadScene(in, scene, settings, error))
+        return false;
+    for (auto source : scene.GetActiveSource())
+        source->E.setGrid(source->E.getSize(), source->E.getSize() / SAMPLES);
+    return true;
+}
+
+// Largest difference between the two scenes' sensed fields, relative to the largest amplitude
+static double difference(Scene &a, Scene &b)
+{
+    std::vector<Camera *> ca = a.GetSensors(), cb = b.GetSensors();
+    double diff = 0.0, peak = 0.0;
+    for (size_t k = 0; k < ca.size(); k++)
+    {
+        WaveFront &A = ca[k]->getSensedWaveFront();
+        WaveFront &B = cb[k]->getSensedWaveFront();
+        for (int i = 0; i < A.N; i++)
+            for (int j = 0; j < A.N; j++)
+            {
+                double d = std::abs(A.Ex[i][j] - B.Ex[i][j]) + std::abs(A.Ey[i][j] - B.Ey[i][j]);
+                double m = std::abs(B.Ex[i][j]) + std::abs(B.Ey[i][j]);
+                diff = max(diff, d);
+                peak = max(peak, m);
+            }
+    }
+    return peak > 0.0 ? diff / peak : INF;
+}
+
+// True if an out-of-core run of text is refused with an error that mentions reason
+static bool refused(const std::string &text, const std::string &reason)
+{
+    Scene scene;
+    SimulationSettings settings;
+    std::string error;
+    CHECK(read(text, scene, settings, error));
+    if (OutOfCoreSimulation::Run(scene, settings, SAMPLES, "", 1 << 20, error))
+        return false;
+    return error.find(reason) != std::string::npos;
+}
+
+int main()
+{
+    const char *cameras[] = {"Camera 0 0 0.2 0 0 1 zoom=0",
+                             "Camera 0 0 0.2 0 0 1 zoom=0 resolution=100 roi=0.006 roix=0.001 roiy=-0.0005"};
+    for (const char *guard : {"1", "1.5"})
+        for (const char *camera : cameras)
+        {
+            char text[1024];
+            std::snprintf(text, sizeof text, SCENE, guard, camera);
+
+            Scene a, b;
+            SimulationSettings sa, sb;
+            std::string error;
+            CHECK(read(text, a, sa, error) && read(text, b, sb, error));
+
+            // Room for a quarter of the padded grid's rows, so each pass takes at least four blocks
+            const int n = nextFastFFTSize((int)std::ceil(SAMPLES * std::stod(guard)));
+            const size_t budget = sizeof(fftw_complex) * n * (n / 4);
+            CHECK(OutOfCoreSimulation::Run(a, sa, SAMPLES, "", budget, error));
+            CHECK(error.empty());
+            SimulationEngine::Run(b, sb);
+            CHECK(difference(a, b) < 1e-10);
+        }
+
+    // What the engine would run with a varying grid, the far field and whole-field elements
+    CHECK(refused("Source 0 0 0 0 0 1\nCamera 0 0 0.1 0 0 1\n", "adaptive=0 analytic=0"));
+    CHECK(refused("Settings adaptive=0 analytic=0\nSource 0 0 0 0 0 1\nCamera 0 0 200 0 0 1\n", "far field"));
+    CHECK(refused("Settings adaptive=0 analytic=0\nSource 0 0 0 0 0 1\nMirror 0 0 0.1 0 0 -1\n", "needs the whole field"));
+    return failures();
+}
@@ -0,0 +1,93 @@
+// ReadScene / WriteScene: a scene written back reads as the same scene, and bad descriptions are
+// rejected with the line at fault
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include "check.hpp"
+#include "serialization.hpp"
+
+static const char *SCENE =
+    "# Relay with a slit\n"
+    "Settings adaptive=0 analytic=1\n"
+    "Source 0 0 0 0 0 1 field=lg l=2 p=1 waist=0.8e-3 wavelength=532e-9 psi=0.3 delta=0.5 guard=1.5\n"
+    "ConvexLens 0 0 0.1 0 0 1 focal=0.2 diameter=0.02\n"
+    "ConcaveLens 0 0 0.15 0 0 1 focal=-0.4\n"
+    "Slit 0 0 0.2 0 0 1 width=0.002 height=0.008\n"
+    "Iris 0 0.001 0.25 0 0 1 radius=0.004\n"
+    "Mirror 0 0 0.3 0 0.5 -1\n"
+    "Camera 0 0.2 0.2 0 -1 0 resolution=128\n";
+
+static bool read(const std::string &text, Scene &scene, SimulationSettings &settings, std::string &error)
+{
+    std::istringstream in(text);
+    return ReadScene(in, scene, settings, error);
+}
+
+static std::string write(Scene &scene, const SimulationSettings &settings)
+{
+    std::ostringstream out;
+    WriteScene(out, scene, settings);
+    return out.str();
+}
+
+// Same words, numbers equal to within rounding: orientations are stored normalized, and normalizing
+// them again on reading may move their last digits
+static bool sameDescription(const std::string &a, const std::string &b)
+{
+    std::istringstream wordsA(a), wordsB(b);
+    std::string x, y;
+    while (wordsA >> x)
+    {
+        if (!(wordsB >> y))
+            return false;
+        const size_t equals = x.find('=');
+        if (equals != y.find('=') || x.compare(0, equals + 1, y, 0, equals + 1) != 0)
+            return false;
+        const std::string valueX = equals == std::string::npos ? x : x.substr(equals + 1);
+        const std::string valueY = equals == std::string::npos ? y : y.substr(equals + 1);
+        char *endX, *endY;
+        const double numberX = std::strtod(valueX.c_str(), &endX), numberY = std::strtod(valueY.c_str(), &endY);
+        if (*endX || *endY || valueX.empty())
+        {
+            if (valueX != valueY)
+                return false;
+        }
+        else if (std::abs(numberX - numberY) > 1e-12 * std::abs(numberX))
+            return false;
+    }
+    return !(wordsB >> y);
+}
+
+int main()
+{
+    Scene scene;
+    SimulationSettings settings;
+    std::string error;
+    CHECK(read(SCENE, scene, settings, error));
+    CHECK(error.empty());
+    if (!error.empty())
+        std::cerr << error << std::endl;
+    CHECK(!settings.adaptiveSampling && settings.analyticBeams);
+    CHECK(scene.GetObjects().size() == 7);
+
+    // Written, read back and written again: the two descriptions match
+    const std::string first = write(scene, settings);
+    Scene again;
+    SimulationSettings againSettings;
+    CHECK(read(first, again, againSettings, error));
+    CHECK(sameDescription(write(again, againSettings), first));
+    CHECK(again.GetObjects().size() == scene.GetObjects().size());
+
+    // Errors name the line
+    for (const char *bad : {"Camera 0 0 1 0 0 1 colour=red\n", "Mirror 0 0 1 0 0 1 size=abc\n", "Lens 0 0 0 0 0 1\n",
+                            "Source 0 0 0 0 0 1 waist=1e-3 coherence=0.05e-3\n"})
+    {
+        Scene rejected;
+        SimulationSettings rejectedSettings;
+        std::string message;
+        CHECK(!read(std::string("# comment\n") + bad, rejected, rejectedSettings, message));
+        CHECK(message.compare(0, 7, "line 2:") == 0);
+    }
+    return failures();
+}
@@ -0,0 +1,142 @@
+// A sweep over a loopback server, cut off as a crash would leave it and run again: the resumed
+// run only simulates the jobs that were lost, and the archive ends up with every job once
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "check.hpp"
+#include "simulation_server.hpp"
+#include "sweep_coordinator.hpp"
+
+static const char *SWEEP =
+    "Settings adaptive=0 analytic=1\n"
+    "Source 0 0 0 0 0 1 waist=0.5e-3\n"
+    "ConvexLens 0 0 0.1 0 0 1\n"
+    "Camera 0 0 0.3 0 0 1 resolution=32\n"
+    "Sweep 2 focal 0.1 0.2 0.3\n"
+    "Sweep 3 resolution 16 32\n";
+
+struct Record
+{
+    size_t job;
+    size_t end;       // Offset just past the record
+    std::string text; // Header line and field bytes
+};
+
+static std::string load(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// Records of an archive: "OSLSWEEP 1", "SPEC <bytes>" and the description, then per camera field
+// "RESULT <job> <camera> <bytes> <label>" and the field
+static std::vector<Record> records(const std::string &archive)
+{
+    std::vector<Record> found;
+    std::istringstream in(archive);
+    std::string line;
+    size_t specBytes = 0;
+    if (!std::getline(in, line) || line != "OSLSWEEP 1" || !std::getline(in, line) || line.compare(0, 5, "SPEC ") != 0)
+        return found;
+    specBytes = std::stoull(line.substr(5));
+    in.seekg((std::streamoff)specBytes, std::ios::cur);
+
+    while (true)
+    {
+        const size_t start = (size_t)in.tellg();
+        if (!std::getline(in, line))
+            break;
+        std::istringstream words(line);
+        std::string word;
+        size_t job, bytes;
+        int camera;
+        if (!(words >> word >> job >> camera >> bytes) || word != "RESULT" || start + line.size() + 1 + bytes > archive.size())
+            break;
+        const size_t end = start + line.size() + 1 + bytes;
+        found.push_back({job, end, archive.substr(start, end - start)});
+        in.seekg((std::streamoff)end);
+    }
+    return found;
+}
+
+static bool run(const char *description, int port, const std::string &archive, const std::string &checkpoint, std::string &error)
+{
+    SweepSpec spec;
+    std::istringstream in(description);
+    if (!ReadSweep(in, spec, error))
+        return false;
+    SweepCoordinator coordinator;
+    return coordinator.Run(spec, {{"127.0.0.1", port}}, archive, checkpoint, error);
+}
+
+int main()
+{
+    namespace fs = std::filesystem;
+    const std::string archive = (fs::temp_directory_path() / "osl_sweep_resume_test.osl").string();
+    const std::string checkpoint = archive + ".done";
+    fs::remove(archive);
+    fs::remove(checkpoint);
+
+    SimulationServer server;
+    CHECK(server.Start(0));
+    std::thread serving(&SimulationServer::Serve, &server);
+
+    // Uninterrupted run: 6 jobs, one camera each
+    std::string error;
+    CHECK(run(SWEEP, server.getPort(), archive, checkpoint, error));
+    const std::string complete = load(archive);
+    const std::vector<Record> expected = records(complete);
+    CHECK(expected.size() == 6);
+    CHECK(server.getCompleted() == 6);
+
+    // A crash in the middle of the third record: two lines checkpointed and a third cut short,
+    // the archive ending inside the record after them
+    std::vector<std::string> lines;
+    {
+        std::ifstream in(checkpoint);
+        for (std::string line; std::getline(in, line);)
+            lines.push_back(line);
+    }
+    CHECK(lines.size() == 7);
+    if (expected.size() == 6 && lines.size() == 7)
+    {
+        {
+            std::ofstream out(checkpoint, std::ios::trunc);
+            out << lines[0] << "\n" << lines[1] << "\n" << lines[2] << "\n" << lines[3].substr(0, 2);
+        }
+        fs::resize_file(archive, expected[1].end + 40);
+
+        CHECK(run(SWEEP, server.getPort(), archive, checkpoint, error));
+        CHECK(server.getCompleted() == 10); // Only the four lost jobs ran again
+
+        const std::vector<Record> resumed = records(load(archive));
+        CHECK(resumed.size() == 6);
+        std::map<size_t, int> seen;
+        for (auto &record : resumed)
+            seen[record.job]++;
+        CHECK(seen.size() == 6);
+        for (auto &job : seen)
+            CHECK(job.second == 1);
+        CHECK(resumed.size() >= 2 && resumed[0].text == expected[0].text && resumed[1].text == expected[1].text);
+    }
+
+    // Nothing left to do: a third run simulates nothing
+    CHECK(run(SWEEP, server.getPort(), archive, checkpoint, error));
+    CHECK(server.getCompleted() == 10);
+
+    // The files belong to this sweep only
+    std::string other = std::string(SWEEP) + "Sweep 1 waist 1e-3 2e-3\n";
+    CHECK(!run(other.c_str(), server.getPort(), archive, checkpoint, error));
+    CHECK(error.find("different sweep") != std::string::npos);
+
+    server.Stop();
+    serving.join();
+    fs::remove(archive);
+    fs::remove(checkpoint);
+    return failures();
+}